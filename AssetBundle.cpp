@@ -0,0 +1,38 @@
+/**
+ * Lookup into the embedded asset bundle.
+ * See the associated header file (AssetBundle.hpp) for the Asset layout and
+ * bundle-gen.cpp for how the bundle itself is generated.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "AssetBundle.hpp"
+
+/**
+ * Binary searches the (sorted) bundle index for the requested path. A
+ * directory requested without its trailing '/' falls back to the '/' entry,
+ * mirroring how the filesystem mode treats "dir" and "dir/" the same.
+ *
+ * @param path The request path (e.g. "/index.html").
+ * @returns The matching asset, or nullptr if it isn't in the bundle.
+ */
+const Asset *findAsset(const std::string &path) {
+	auto less = [](const Asset &a, const char *p) {
+		return std::strcmp(a.path, p) < 0;
+	};
+	const Asset *end = bundle_assets + bundle_asset_count;
+
+	const Asset *found = std::lower_bound(bundle_assets, end, path.c_str(), less);
+	if (found != end && path == found->path) {
+		return found;
+	}
+
+	if (!path.empty() && path.back() != '/') {
+		std::string dir_path = path + "/";
+		found = std::lower_bound(bundle_assets, end, dir_path.c_str(), less);
+		if (found != end && dir_path == found->path) {
+			return found;
+		}
+	}
+	return nullptr;
+}
@@ -0,0 +1,31 @@
+#include <cstddef>
+#include <string>
+
+/**
+ * One file (or directory page) packed into the binary by bundle-gen.
+ *
+ * Every field points into read-only data emitted by the generator, so an
+ * Asset can be sent without touching the filesystem. Headers are prebuilt
+ * (status line included) so a response is just header + body.
+ */
+struct Asset {
+	const char *path;              // request path, e.g. "/test/dir/"
+	const char *mime_type;
+	const char *etag;              // quoted, e.g. "\"1f2e...\""
+	const char *header;            // "HTTP/1.0 200 OK\r\n...\r\n\r\n"
+	size_t header_length;
+	const unsigned char *body;
+	size_t body_length;
+	const char *gzip_header;       // nullptr if no gzip variant was built
+	size_t gzip_header_length;
+	const unsigned char *gzip_body;
+	size_t gzip_body_length;
+	const char *not_modified;      // prebuilt 304 response for If-None-Match
+	size_t not_modified_length;
+};
+
+// Defined in the generated bundle source, sorted by path.
+extern const Asset bundle_assets[];
+extern const size_t bundle_asset_count;
+
+const Asset *findAsset(const std::string &path);
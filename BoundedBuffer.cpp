@@ -3,6 +3,7 @@
  * See the associated header file (BoundedBuffer.hpp) for the declaration of
  * this class.
  */
+#include <algorithm>
 #include <cstdio>
 
 #include "BoundedBuffer.hpp"
@@ -12,29 +13,64 @@
  * initialized to en empty queue.
  *
  * @param max_size The desired capacity for the buffer.
+ * @param quantum Credit each queued client gets per round-robin round.
+ * @param request_cost Cost charged when an item is taken out.
  */
-BoundedBuffer::BoundedBuffer(int max_size) {
+BoundedBuffer::BoundedBuffer(int max_size, int64_t quantum, int64_t request_cost)
+	: quantum(quantum), request_cost(request_cost) {
 	capacity = max_size;
 	count = 0;
 	head = 0;
 	tail = 0;
 
-	// buffer field implicitly has its default (no-arg) constructor called.
-	// This means we have a new buffer with no items in it.
+	// clients and active implicitly have their default (no-arg) constructors
+	// called. This means we have a new buffer with no items in it.
 }
 
 /**
- * Gets the first item from the buffer then removes it.
+ * Gets the next item (in deficit-round-robin order) from the buffer then
+ * removes it.
  */
 int BoundedBuffer::getItem() {
+	std::chrono::steady_clock::time_point queued_at;
+	uint32_t client;
+	return getItem(queued_at, client);
+}
+
+/**
+ * Gets the next item from the buffer then removes it, also reporting when
+ * that item was put in (so callers can measure time spent queued) and which
+ * client it belongs to (so callers can charge for it).
+ *
+ * @param queued_at Set to the time the item was added to the buffer.
+ * @param client Set to the client the item was added for.
+ */
+int BoundedBuffer::getItem(std::chrono::steady_clock::time_point &queued_at,
+		uint32_t &client) {
 	std::unique_lock<std::mutex> cv_lock(m); //aquire or wait for lock and shared mutex
 	while (count == 0) {
 		data_available.wait(cv_lock);
 	}
 	count--;
 
-	int item = this->buffer.front(); // "this" refers to the calling object...
-	buffer.pop(); // ... but like Java it is optional (no this in front of buffer on this line)
+	client = nextClient();
+	ClientQueue &queue = clients[client];
+	int item = queue.items.front();
+	queue.items.pop();
+	queued_at = queue.put_times.front();
+	queue.put_times.pop();
+	queue.deficit -= request_cost;
+
+	// Move on to the next client, forgetting this one if it has nothing left
+	// queued (a client that isn't waiting doesn't carry debt into its next visit).
+	active.pop_front();
+	if (queue.items.empty()) {
+		clients.erase(client);
+	}
+	else {
+		active.push_back(client);
+	}
+
 	tail++;
 	if (tail == capacity) {
 		tail = 0;
@@ -45,18 +81,55 @@ int BoundedBuffer::getItem() {
 }
 
 /**
- * Adds a new item to the back of the buffer.
+ * Rotates the round-robin order until its front client has a positive
+ * deficit, crediting each client passed over a quantum. The lock must be
+ * held and at least one item queued.
+ *
+ * @returns The client to serve next (left at the front of active).
+ */
+uint32_t BoundedBuffer::nextClient() {
+	// If everyone is in debt, credit whole rounds at once rather than
+	// spinning through them one quantum at a time.
+	int64_t best = INT64_MIN;
+	for (uint32_t client : active) {
+		best = std::max(best, clients[client].deficit);
+	}
+	if (best <= 0) {
+		int64_t rounds = -best / quantum;
+		for (uint32_t client : active) {
+			clients[client].deficit += rounds * quantum;
+		}
+	}
+
+	while (clients[active.front()].deficit <= 0) {
+		uint32_t client = active.front();
+		clients[client].deficit += quantum;
+		active.pop_front();
+		active.push_back(client);
+	}
+	return active.front();
+}
+
+/**
+ * Adds a new item to the back of its client's queue.
  *
  * @param new_item The item to put in the buffer.
+ * @param client Who the item is for (e.g. the IPv4 address it came from).
  */
-void BoundedBuffer::putItem(int new_item) {
+void BoundedBuffer::putItem(int new_item, uint32_t client) {
 	std::unique_lock<std::mutex> cv_lock(m);
 	while (count == capacity) {
 		space_available.wait(cv_lock);
 	}
 	count++;
 
-	buffer.push(new_item);
+	auto inserted = clients.try_emplace(client);
+	if (inserted.second) {
+		active.push_back(client); // newly waiting clients join the end of the round
+	}
+	ClientQueue &queue = inserted.first->second;
+	queue.items.push(new_item);
+	queue.put_times.push(std::chrono::steady_clock::now());
 	head++;
 	if (head == capacity) {
 		head = 0;
@@ -64,3 +137,19 @@ void BoundedBuffer::putItem(int new_item) {
 	data_available.notify_one();
 	cv_lock.unlock();
 }
+
+/**
+ * Charges a client for work done on one of its items, once the cost is
+ * known. Clients with nothing queued aren't competing, so they aren't
+ * charged.
+ *
+ * @param client The client the item was for.
+ * @param cost What serving the item cost (e.g. bytes sent).
+ */
+void BoundedBuffer::charge(uint32_t client, int64_t cost) {
+	std::lock_guard<std::mutex> lock(m);
+	auto it = clients.find(client);
+	if (it != clients.end()) {
+		it->second.deficit -= cost;
+	}
+}
@@ -1,10 +1,21 @@
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_map>
 
 /**
  * Class representing a buffer with a fixed capacity.
  *
+ * Items are tagged with the client they came from and handed out
+ * deficit-round-robin across clients rather than strictly FIFO, so one client
+ * with many items queued can't starve the others. Each client in the rotation
+ * is credited a quantum per round and is served while its deficit is
+ * positive; serving an item costs a fixed request_cost up front, and callers
+ * charge the rest (e.g. the bytes actually sent) once they know it.
+ *
  * Note that in C++, the header (i.e. hpp) file contains a declaration of the
  * class while the implementation of the constructors, destructors, and methods,
  * and given in an implementation (i.e. cpp) file.
@@ -13,11 +24,14 @@ class BoundedBuffer {
   // begin section containing publicly accessible parts of the class
   public:
 	  // public constructor
-	  BoundedBuffer(int max_size);
+	  BoundedBuffer(int max_size, int64_t quantum = 64 * 1024,
+			  int64_t request_cost = 4 * 1024);
 	  
 	  // public member functions (a.k.a. methods)
 	  int getItem();
-	  void putItem(int new_item);
+	  int getItem(std::chrono::steady_clock::time_point &queued_at, uint32_t &client);
+	  void putItem(int new_item, uint32_t client = 0);
+	  void charge(uint32_t client, int64_t cost);
 
 	int count;
 	int head;
@@ -26,8 +40,19 @@ class BoundedBuffer {
   // begin section containing private (i.e. hidden) parts of the class
   private:
 	  // private member variables (i.e. fields)
+	  struct ClientQueue {
+		  std::queue<int> items;
+		  std::queue<std::chrono::steady_clock::time_point> put_times; // parallel to items
+		  int64_t deficit = 0;
+	  };
+
+	  uint32_t nextClient();
+
 	  int capacity;
-	  std::queue<int> buffer;
+	  int64_t quantum;
+	  int64_t request_cost;
+	  std::unordered_map<uint32_t, ClientQueue> clients; // only clients with items queued
+	  std::deque<uint32_t> active; // round-robin order of those clients
 	  std::mutex m;
 	  std::condition_variable data_available;
 	  std::condition_variable space_available;
@@ -0,0 +1,258 @@
+/**
+ * Implementation of the ClientLimiter and SendShaper classes.
+ * See the associated header file (ClientLimiter.hpp) for the declarations.
+ */
+#include <algorithm>
+
+#include "ClientLimiter.hpp"
+
+namespace {
+
+const size_t NUM_STRIPES = 64;
+// How far a lookup probes from an address's home slot before giving up.
+const size_t MAX_PROBE = 16;
+
+// Mixes every bit of the address into every bit of the hash (the murmur3
+// finalizer), so addresses sharing a prefix still spread across stripes.
+uint32_t hashClient(uint32_t client) {
+	client ^= client >> 16;
+	client *= 0x85ebca6b;
+	client ^= client >> 13;
+	client *= 0xc2b2ae35;
+	client ^= client >> 16;
+	return client;
+}
+
+} // namespace
+
+/**
+ * Constructor that sets the limits and allocates the (empty) table.
+ *
+ * @param max_connections Most connections one client may have open (0 for
+ * no limit).
+ * @param request_rate Requests per second one client may sustain (0 for no
+ * limit).
+ * @param request_burst Requests a client may make back to back before the
+ * rate applies.
+ * @param capacity Roughly how many clients the table can track at once.
+ */
+ClientLimiter::ClientLimiter(uint32_t max_connections, double request_rate,
+		double request_burst, size_t capacity)
+	: max_connections(max_connections), request_rate(request_rate),
+	  request_burst(std::max(1.0, request_burst)),
+	  epoch(std::chrono::steady_clock::now()),
+	  stripes(new Stripe[NUM_STRIPES]) {
+	size_t per_stripe = std::max(capacity / NUM_STRIPES, MAX_PROBE);
+	for (size_t i = 0; i < NUM_STRIPES; ++i) {
+		stripes[i].slots.resize(per_stripe);
+	}
+}
+
+/**
+ * @returns true if any limit is set (otherwise admit always says yes).
+ */
+bool ClientLimiter::enabled() const {
+	return max_connections > 0 || request_rate > 0;
+}
+
+/**
+ * Decides whether to accept a new connection from a client, counting it as
+ * open (until release is called) and as one request if so.
+ *
+ * @param client The client's IPv4 address (in any fixed byte order).
+ * @returns ADMITTED, or which limit the client is over.
+ */
+ClientLimiter::Admission ClientLimiter::admit(uint32_t client) {
+	if (!enabled()) {
+		return ADMITTED;
+	}
+	uint32_t hash = hashClient(client);
+	uint32_t now_ms = nowMs();
+	Stripe &stripe = stripes[hash % NUM_STRIPES];
+	std::lock_guard<std::mutex> lock(stripe.m);
+
+	Entry *entry = find(stripe, hash, client, true, now_ms);
+	if (entry == nullptr) {
+		return ADMITTED;
+	}
+	if (max_connections > 0 && entry->connections >= max_connections) {
+		return TOO_MANY_CONNECTIONS;
+	}
+	if (request_rate > 0) {
+		refill(*entry, now_ms);
+		if (entry->tokens < 1) {
+			return RATE_LIMITED;
+		}
+		entry->tokens -= 1;
+	}
+	entry->connections++;
+	return ADMITTED;
+}
+
+/**
+ * Takes a request token for an additional request on a connection that was
+ * already admitted (e.g. another HTTP/2 stream).
+ *
+ * @param client The client's IPv4 address.
+ * @returns false if the client is over its request rate.
+ */
+bool ClientLimiter::allowRequest(uint32_t client) {
+	if (request_rate <= 0) {
+		return true;
+	}
+	uint32_t hash = hashClient(client);
+	uint32_t now_ms = nowMs();
+	Stripe &stripe = stripes[hash % NUM_STRIPES];
+	std::lock_guard<std::mutex> lock(stripe.m);
+
+	Entry *entry = find(stripe, hash, client, false, now_ms);
+	if (entry == nullptr) {
+		return true;
+	}
+	refill(*entry, now_ms);
+	if (entry->tokens < 1) {
+		return false;
+	}
+	entry->tokens -= 1;
+	return true;
+}
+
+/**
+ * Records that one of a client's admitted connections has closed.
+ *
+ * @param client The client's IPv4 address.
+ */
+void ClientLimiter::release(uint32_t client) {
+	if (!enabled()) {
+		return;
+	}
+	uint32_t hash = hashClient(client);
+	Stripe &stripe = stripes[hash % NUM_STRIPES];
+	std::lock_guard<std::mutex> lock(stripe.m);
+
+	Entry *entry = find(stripe, hash, client, false, nowMs());
+	if (entry != nullptr && entry->connections > 0) {
+		entry->connections--;
+	}
+}
+
+/**
+ * Looks a client up in its stripe (whose lock must be held) by linear
+ * probing from its home slot. Never-used slots end a probe, since slots are
+ * only ever reused, never emptied.
+ *
+ * @param create Whether to claim a free or idle slot if the client isn't
+ * found.
+ * @returns The client's entry, or nullptr if it has none (and none could be
+ * created).
+ */
+ClientLimiter::Entry *ClientLimiter::find(Stripe &stripe, uint32_t hash,
+		uint32_t client, bool create, uint32_t now_ms) {
+	size_t num_slots = stripe.slots.size();
+	size_t home = (hash / NUM_STRIPES) % num_slots;
+	Entry *reusable = nullptr;
+	for (size_t i = 0; i < MAX_PROBE && i < num_slots; ++i) {
+		Entry &entry = stripe.slots[(home + i) % num_slots];
+		if (entry.client == client) {
+			return &entry;
+		}
+		if (entry.client == 0) {
+			if (reusable == nullptr) {
+				reusable = &entry;
+			}
+			break;
+		}
+		if (reusable == nullptr && idle(entry, now_ms)) {
+			reusable = &entry;
+		}
+	}
+	if (!create || reusable == nullptr) {
+		return nullptr;
+	}
+	reusable->client = client;
+	reusable->connections = 0;
+	reusable->tokens = request_burst;
+	reusable->refilled_ms = now_ms;
+	return reusable;
+}
+
+/**
+ * Adds the tokens earned since the entry was last refilled.
+ */
+void ClientLimiter::refill(Entry &entry, uint32_t now_ms) const {
+	uint32_t elapsed_ms = now_ms - entry.refilled_ms;
+	entry.tokens = std::min(request_burst,
+			entry.tokens + elapsed_ms * request_rate / 1000);
+	entry.refilled_ms = now_ms;
+}
+
+/**
+ * @returns true if forgetting this entry would change nothing: the client
+ * has no open connections and its bucket would be full by now.
+ */
+bool ClientLimiter::idle(const Entry &entry, uint32_t now_ms) const {
+	if (entry.connections > 0) {
+		return false;
+	}
+	uint32_t elapsed_ms = now_ms - entry.refilled_ms;
+	return request_rate <= 0
+		|| entry.tokens + elapsed_ms * request_rate / 1000 >= request_burst;
+}
+
+uint32_t ClientLimiter::nowMs() const {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - epoch).count();
+}
+
+/**
+ * Constructor that starts the bucket full. The bucket holds a tenth of a
+ * second's worth of bytes (but at least 16 KB), which is also the most
+ * handed out per chunk.
+ *
+ * @param bytes_per_sec The rate to pace sends to (0 for unlimited).
+ */
+SendShaper::SendShaper(uint64_t bytes_per_sec)
+	: rate(bytes_per_sec),
+	  burst(std::max(bytes_per_sec / 10.0, 16.0 * 1024)),
+	  tokens(burst),
+	  refilled(std::chrono::steady_clock::now()) {
+}
+
+/**
+ * @returns true if sends should be paced at all.
+ */
+bool SendShaper::limited() const {
+	return rate > 0;
+}
+
+/**
+ * @param remaining Bytes left to send.
+ * @returns How many of them to send in the next chunk.
+ */
+size_t SendShaper::chunkSize(size_t remaining) const {
+	if (!limited()) {
+		return remaining;
+	}
+	return std::min(remaining, (size_t) burst);
+}
+
+/**
+ * Takes tokens for the next chunk, going into debt if there aren't enough.
+ *
+ * @param bytes Size of the chunk about to be sent.
+ * @returns How long to wait before sending it (zero if it may go now).
+ */
+std::chrono::nanoseconds SendShaper::reserve(size_t bytes) {
+	if (!limited()) {
+		return std::chrono::nanoseconds(0);
+	}
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - refilled).count();
+	tokens = std::min(burst, tokens + elapsed * rate);
+	refilled = now;
+	tokens -= bytes;
+	if (tokens >= 0) {
+		return std::chrono::nanoseconds(0);
+	}
+	return std::chrono::nanoseconds((int64_t) (-tokens * 1e9 / rate));
+}
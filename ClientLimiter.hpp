@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Per-client (source IPv4 address) limits, checked as connections are
+ * accepted: a cap on how many connections one client may have open at once,
+ * and a token bucket on how fast it may make requests.
+ *
+ * The state lives in a fixed-size open-addressing hash table of 16-byte
+ * entries, split into independently locked stripes so the accepting thread
+ * and the threads releasing connections rarely contend. An entry is reused
+ * once its client has no connections open and a full bucket (i.e. it has
+ * been idle long enough to be indistinguishable from a new client). If no
+ * slot can be found the client is let through untracked, so a full table
+ * never turns into an outage.
+ */
+class ClientLimiter {
+  public:
+	  enum Admission { ADMITTED, TOO_MANY_CONNECTIONS, RATE_LIMITED };
+
+	  // 0 disables the corresponding limit.
+	  ClientLimiter(uint32_t max_connections, double request_rate,
+			  double request_burst, size_t capacity = 16384);
+
+	  bool enabled() const;
+	  Admission admit(uint32_t client);
+	  bool allowRequest(uint32_t client);
+	  void release(uint32_t client);
+
+  private:
+	  struct Entry {
+		  uint32_t client = 0; // 0 (0.0.0.0) marks a never-used slot
+		  uint32_t connections = 0;
+		  float tokens = 0;
+		  uint32_t refilled_ms = 0; // since epoch, wraps after ~49 days
+	  };
+
+	  struct Stripe {
+		  std::mutex m;
+		  std::vector<Entry> slots;
+	  };
+
+	  Entry *find(Stripe &stripe, uint32_t hash, uint32_t client, bool create,
+			  uint32_t now_ms);
+	  void refill(Entry &entry, uint32_t now_ms) const;
+	  bool idle(const Entry &entry, uint32_t now_ms) const;
+	  uint32_t nowMs() const;
+
+	  uint32_t max_connections;
+	  double request_rate; // tokens per second
+	  double request_burst;
+	  std::chrono::steady_clock::time_point epoch;
+	  std::unique_ptr<Stripe[]> stripes;
+};
+
+/**
+ * Token bucket pacing one connection's sends to a byte rate. The sender asks
+ * for permission to send the next chunk and sleeps for the returned delay
+ * first, so the rate holds on average while bursts stay under one chunk.
+ */
+class SendShaper {
+  public:
+	  // 0 means unlimited.
+	  SendShaper(uint64_t bytes_per_sec = 0);
+
+	  bool limited() const;
+	  size_t chunkSize(size_t remaining) const;
+	  std::chrono::nanoseconds reserve(size_t bytes);
+
+  private:
+	  uint64_t rate;
+	  double burst;
+	  double tokens;
+	  std::chrono::steady_clock::time_point refilled;
+};
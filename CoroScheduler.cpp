@@ -0,0 +1,381 @@
+/**
+ * Implementation of the BlockingPool, EventLoop, CoroScheduler, and
+ * AsyncSocket classes.
+ * See the associated header file (CoroScheduler.hpp) for the declarations.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include "CoroScheduler.hpp"
+
+namespace {
+
+thread_local EventLoop *current_loop = nullptr;
+
+/**
+ * Coroutine type for a task nobody awaits: it starts immediately and frees
+ * its own frame when done.
+ */
+struct Detached {
+	struct promise_type {
+		Detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() {}
+	};
+};
+
+Detached runDetached(Task<void> task) {
+	try {
+		co_await task;
+	}
+	catch (const std::exception &e) {
+		// a connection failing (e.g. peer reset) only ends that connection
+	}
+}
+
+[[noreturn]] void throwErrno(const char *what) {
+	std::error_code ec(errno, std::generic_category());
+	throw std::system_error(ec, what);
+}
+
+} // namespace
+
+/**
+ * Constructor that starts the pool's (detached) threads.
+ *
+ * @param num_threads How many blocking calls can run at once.
+ */
+BlockingPool::BlockingPool(size_t num_threads) {
+	for (size_t i = 0; i < num_threads; ++i) {
+		std::thread worker([this]() {
+			while (true) {
+				std::unique_lock<std::mutex> lock(m);
+				while (jobs.empty()) {
+					job_available.wait(lock);
+				}
+				std::function<void()> job = std::move(jobs.front());
+				jobs.pop_front();
+				lock.unlock();
+				job();
+			}
+		});
+		worker.detach();
+	}
+}
+
+/**
+ * Queues a job to run on one of the pool's threads.
+ *
+ * @param job The work to do.
+ */
+void BlockingPool::submit(std::function<void()> job) {
+	std::lock_guard<std::mutex> lock(m);
+	jobs.push_back(std::move(job));
+	job_available.notify_one();
+}
+
+/**
+ * Constructor that sets up the loop's epoll instance. The loop doesn't run
+ * until run() is called (on the thread that will own it).
+ *
+ * @param blocking Pool used for BlockingCalls made from this loop.
+ * @param long_running Pool used for long-running BlockingCalls.
+ */
+EventLoop::EventLoop(BlockingPool &blocking, BlockingPool &long_running)
+	: blocking(blocking), long_running(long_running) {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epoll_fd < 0 || wake_fd < 0) {
+		perror("Creating event loop failed");
+		exit(1);
+	}
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr; // nullptr marks the wake_fd
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+}
+
+/**
+ * @returns The loop running on the calling thread (nullptr if none).
+ */
+EventLoop *EventLoop::current() {
+	return current_loop;
+}
+
+/**
+ * Runs the loop forever: start new tasks, resume posted coroutines, and
+ * resume coroutines whose sockets became ready.
+ */
+void EventLoop::run() {
+	current_loop = this;
+	struct epoll_event events[64];
+	while (true) {
+		drain();
+		int n = epoll_wait(epoll_fd, events, 64, -1);
+		for (int i = 0; i < n; ++i) {
+			if (events[i].data.ptr == nullptr) {
+				uint64_t count;
+				while (read(wake_fd, &count, sizeof(count)) > 0) {
+				}
+				continue;
+			}
+			std::coroutine_handle<>::from_address(events[i].data.ptr).resume();
+		}
+	}
+}
+
+/**
+ * Hands a new task to this loop, which starts it on its own thread.
+ *
+ * @param task The task to run to completion.
+ */
+void EventLoop::start(Task<void> task) {
+	{
+		std::lock_guard<std::mutex> lock(m);
+		new_tasks.push_back(std::move(task));
+	}
+	uint64_t one = 1;
+	write(wake_fd, &one, sizeof(one));
+}
+
+/**
+ * Asks this loop to resume a suspended coroutine.
+ *
+ * @param h The coroutine to resume.
+ */
+void EventLoop::post(std::coroutine_handle<> h) {
+	{
+		std::lock_guard<std::mutex> lock(m);
+		ready.push_back(h);
+	}
+	uint64_t one = 1;
+	write(wake_fd, &one, sizeof(one));
+}
+
+/**
+ * Arranges for h to be resumed once fd is ready. The registration is one-shot
+ * so a socket never wakes a coroutine that isn't waiting on it.
+ *
+ * @param fd The socket to wait on.
+ * @param events EPOLLIN or EPOLLOUT.
+ * @param registered Whether fd is already in this loop's epoll set (updated).
+ * @param h The coroutine to resume.
+ */
+void EventLoop::waitFor(int fd, uint32_t events, bool &registered,
+		std::coroutine_handle<> h) {
+	struct epoll_event ev = {};
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = h.address();
+	if (epoll_ctl(epoll_fd, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0) {
+		throwErrno("epoll_ctl failed");
+	}
+	registered = true;
+}
+
+/**
+ * Starts queued tasks and resumes posted coroutines.
+ */
+void EventLoop::drain() {
+	std::deque<Task<void>> tasks;
+	std::deque<std::coroutine_handle<>> handles;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		tasks.swap(new_tasks);
+		handles.swap(ready);
+	}
+	for (auto &task : tasks) {
+		runDetached(std::move(task));
+	}
+	for (auto h : handles) {
+		h.resume();
+	}
+}
+
+/**
+ * Constructor that starts one (detached) thread per loop.
+ *
+ * @param num_loops Number of event loops (usually one per core).
+ * @param num_blocking_threads Size of the shared blocking pool.
+ * @param num_long_running_threads Size of the shared pool for long-running
+ * work.
+ */
+CoroScheduler::CoroScheduler(size_t num_loops, size_t num_blocking_threads,
+		size_t num_long_running_threads)
+	: blocking(num_blocking_threads), long_running(num_long_running_threads),
+	  next_loop(0) {
+	for (size_t i = 0; i < num_loops; ++i) {
+		loops.push_back(std::make_unique<EventLoop>(blocking, long_running));
+		std::thread loop_thread(&EventLoop::run, loops.back().get());
+		loop_thread.detach();
+	}
+}
+
+/**
+ * Starts a task on the next loop (round-robin). Only one thread (the
+ * accepting one) may call this.
+ *
+ * @param task The task to run to completion.
+ */
+void CoroScheduler::spawn(Task<void> task) {
+	loops[next_loop]->start(std::move(task));
+	next_loop = (next_loop + 1) % loops.size();
+}
+
+/**
+ * Sleeps by waiting on a one-shot timerfd in the current loop's epoll set.
+ *
+ * @param duration How long to sleep.
+ */
+Task<void> sleepFor(std::chrono::nanoseconds duration) {
+	if (duration.count() <= 0) {
+		co_return;
+	}
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		throwErrno("timerfd_create failed");
+	}
+	struct itimerspec when = {};
+	when.it_value.tv_sec = duration.count() / 1000000000;
+	when.it_value.tv_nsec = duration.count() % 1000000000;
+	timerfd_settime(timer_fd, 0, &when, nullptr);
+
+	bool registered = false;
+	try {
+		co_await IoWait{ *EventLoop::current(), timer_fd, EPOLLIN, registered };
+	}
+	catch (...) {
+		close(timer_fd);
+		throw;
+	}
+	close(timer_fd); // also removes it from the epoll set
+}
+
+/**
+ * Takes ownership of a connected socket and makes it non-blocking. Must be
+ * constructed inside a coroutine running on an EventLoop.
+ *
+ * @param fd The socket.
+ */
+AsyncSocket::AsyncSocket(int fd)
+	: fd(fd), loop(*EventLoop::current()), registered(false) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+AsyncSocket::~AsyncSocket() {
+	close(fd); // also removes it from the epoll set
+}
+
+/**
+ * Receives data, suspending until some is available.
+ *
+ * @param dest The buffer where we will store the received data.
+ * @param buff_size Number of bytes in the buffer.
+ * @returns The number of bytes received (0 if the peer closed).
+ */
+Task<size_t> AsyncSocket::recv(char *dest, size_t buff_size) {
+	while (true) {
+		ssize_t n = ::recv(fd, dest, buff_size, 0);
+		if (n >= 0) {
+			co_return n;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			co_await IoWait{ loop, fd, EPOLLIN, registered };
+		}
+		else if (errno != EINTR) {
+			throwErrno("recv failed");
+		}
+	}
+}
+
+/**
+ * Sends all of the data, suspending whenever the socket buffer is full.
+ *
+ * @param data The data to send.
+ * @param data_length Number of bytes of data to send.
+ */
+Task<void> AsyncSocket::send(const char *data, size_t data_length) {
+	while (data_length > 0) {
+		ssize_t n = ::send(fd, data, data_length, MSG_NOSIGNAL);
+		if (n >= 0) {
+			data_length -= n;
+			data += n;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			co_await IoWait{ loop, fd, EPOLLOUT, registered };
+		}
+		else if (errno != EINTR) {
+			throwErrno("send failed");
+		}
+	}
+}
+
+/**
+ * Sends all of a string (kept alive in this coroutine's frame meanwhile).
+ *
+ * @param data The data to send.
+ */
+Task<void> AsyncSocket::send(std::string data) {
+	co_await send(data.c_str(), data.length());
+}
+
+/**
+ * Sends part of a file with sendfile(2), suspending whenever the socket
+ * buffer is full. Stops early if the file turns out to be shorter.
+ *
+ * @param file_fd The open file.
+ * @param offset Where in the file to start.
+ * @param count Number of bytes to send.
+ */
+Task<void> AsyncSocket::sendfile(int file_fd, off_t offset, size_t count) {
+	while (count > 0) {
+		ssize_t n = ::sendfile(fd, file_fd, &offset, count);
+		if (n > 0) {
+			count -= n;
+		}
+		else if (n == 0) {
+			throw std::runtime_error("file truncated during sendfile");
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			co_await IoWait{ loop, fd, EPOLLOUT, registered };
+		}
+		else if (errno != EINTR) {
+			throwErrno("sendfile failed");
+		}
+	}
+}
+
+/**
+ * @param fn Work that has to block (e.g. open/stat, or a blocking protocol
+ * handler after setBlocking()).
+ * @param long_running Run fn on the long-running pool rather than the
+ * blocking one (for work that may block for a long time, like serving a
+ * whole connection).
+ * @returns An awaitable that runs fn off the event loop.
+ */
+BlockingCall AsyncSocket::blocking(std::function<void()> fn, bool long_running) {
+	return BlockingCall{ loop, long_running ? loop.long_running : loop.blocking,
+		std::move(fn), nullptr };
+}
+
+/**
+ * Puts the socket back in blocking mode, for handing it to code written
+ * against blocking sockets (run through blocking()).
+ */
+void AsyncSocket::setBlocking() {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+}
@@ -0,0 +1,160 @@
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Task.hpp"
+
+/**
+ * A few ordinary threads for work that can only be done by blocking (opening
+ * and stat-ing files, or running code written against blocking sockets), so
+ * that it never stalls an event loop.
+ */
+class BlockingPool {
+  public:
+	  BlockingPool(size_t num_threads);
+	  void submit(std::function<void()> job);
+
+  private:
+	  std::mutex m;
+	  std::condition_variable job_available;
+	  std::deque<std::function<void()>> jobs;
+};
+
+/**
+ * One epoll loop, run on its own thread. A coroutine started on a loop stays
+ * on it: every suspension (waiting for a socket, or for blocking work to
+ * finish) resumes on the same thread, so connection state needs no locking.
+ */
+class EventLoop {
+  public:
+	  EventLoop(BlockingPool &blocking, BlockingPool &long_running);
+
+	  void run();
+	  void start(Task<void> task);          // safe to call from any thread
+	  void post(std::coroutine_handle<> h); // safe to call from any thread
+	  void waitFor(int fd, uint32_t events, bool &registered,
+			  std::coroutine_handle<> h);
+
+	  static EventLoop *current();
+
+	  BlockingPool &blocking;
+	  BlockingPool &long_running;
+
+  private:
+	  void drain();
+
+	  int epoll_fd;
+	  int wake_fd; // eventfd used to interrupt epoll_wait for start()/post()
+	  std::mutex m;
+	  std::deque<Task<void>> new_tasks;
+	  std::deque<std::coroutine_handle<>> ready;
+};
+
+/**
+ * A small per-core scheduler: one EventLoop thread per core, plus two
+ * BlockingPools they share, one for short calls and one for long-running work
+ * (so the latter can't hold up the former). New tasks are handed to the loops
+ * round-robin.
+ */
+class CoroScheduler {
+  public:
+	  CoroScheduler(size_t num_loops, size_t num_blocking_threads,
+			  size_t num_long_running_threads);
+	  void spawn(Task<void> task);
+
+  private:
+	  BlockingPool blocking;
+	  BlockingPool long_running;
+	  std::vector<std::unique_ptr<EventLoop>> loops;
+	  size_t next_loop;
+};
+
+/**
+ * Suspends until fd is ready for events (EPOLLIN or EPOLLOUT).
+ */
+struct IoWait {
+	EventLoop &loop;
+	int fd;
+	uint32_t events;
+	bool &registered;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) {
+		loop.waitFor(fd, events, registered, h);
+	}
+	void await_resume() const noexcept {}
+};
+
+/**
+ * Runs fn on one of the loop's blocking pools and resumes the awaiting
+ * coroutine back on its own loop afterwards. Exceptions thrown by fn come out
+ * of the co_await.
+ */
+struct BlockingCall {
+	EventLoop &loop;
+	BlockingPool &pool;
+	std::function<void()> fn;
+	std::exception_ptr exception;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) {
+		auto job = [this, h]() {
+			try {
+				fn();
+			}
+			catch (...) {
+				exception = std::current_exception();
+			}
+			loop.post(h);
+		};
+		pool.submit(job);
+	}
+	void await_resume() {
+		if (exception) std::rethrow_exception(exception);
+	}
+};
+
+/**
+ * Suspends the calling coroutine (which must be running on an EventLoop) for
+ * a while without blocking its loop.
+ */
+Task<void> sleepFor(std::chrono::nanoseconds duration);
+
+/**
+ * A connected socket driven by the current thread's EventLoop. Each
+ * operation tries the system call first and only suspends if it would block.
+ * The socket is closed when this object is destroyed.
+ */
+class AsyncSocket {
+  public:
+	  explicit AsyncSocket(int fd);
+	  ~AsyncSocket();
+
+	  AsyncSocket(const AsyncSocket &) = delete;
+	  AsyncSocket &operator=(const AsyncSocket &) = delete;
+
+	  Task<size_t> recv(char *dest, size_t buff_size);
+	  Task<void> send(const char *data, size_t data_length);
+	  Task<void> send(std::string data);
+	  Task<void> sendfile(int file_fd, off_t offset, size_t count);
+	  BlockingCall blocking(std::function<void()> fn, bool long_running = false);
+
+	  void setBlocking();
+
+	  const int fd;
+
+  private:
+	  EventLoop &loop;
+	  bool registered;
+};
@@ -0,0 +1,257 @@
+/**
+ * Implementation of the HotFileManifest class.
+ * See the associated header file (HotFileManifest.hpp) for the declaration of
+ * this class.
+ */
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "HotFileManifest.hpp"
+
+namespace {
+
+/**
+ * @returns true if a path read from a manifest is safe to prefetch under the
+ * root: absolute (from the root), with no ".." and nothing that would break
+ * the line-based format.
+ */
+bool validPath(const std::string &path) {
+	return !path.empty() && path[0] == '/'
+		&& path.find("..") == std::string::npos
+		&& path.find_first_of(" \t\r\n") == std::string::npos;
+}
+
+} // namespace
+
+/**
+ * Constructor that starts with no counts.
+ *
+ * @param max_tracked Most paths to keep counts for at once.
+ */
+HotFileManifest::HotFileManifest(size_t max_tracked)
+	: max_tracked(max_tracked) {
+}
+
+/**
+ * Reads a saved manifest, seeding the counts with it (so popularity carries
+ * over a restart). Malformed lines and unsafe paths are skipped.
+ *
+ * @param manifest_file The manifest to read.
+ * @returns The number of paths loaded (0 if the file doesn't exist).
+ */
+size_t HotFileManifest::load(const std::string &manifest_file) {
+	std::ifstream in(manifest_file);
+	std::string line;
+	size_t loaded = 0;
+	std::lock_guard<std::mutex> lock(m);
+	while (getline(in, line) && counts.size() < max_tracked) {
+		std::istringstream fields(line);
+		uint64_t count;
+		std::string path;
+		if (!(fields >> count >> path) || count == 0 || !validPath(path)) {
+			continue;
+		}
+		counts[path] += count;
+		loaded++;
+	}
+	return loaded;
+}
+
+/**
+ * Counts one hit on a path.
+ *
+ * @param path The requested path, relative to the root (e.g. "/index.html").
+ */
+void HotFileManifest::record(const std::string &path) {
+	std::lock_guard<std::mutex> lock(m);
+	auto it = counts.find(path);
+	if (it != counts.end()) {
+		it->second++;
+		return;
+	}
+	if (counts.size() >= max_tracked) {
+		decay();
+	}
+	counts.emplace(path, 1);
+}
+
+/**
+ * Halves every count and forgets paths that reach zero. The lock must be
+ * held.
+ */
+void HotFileManifest::decay() {
+	for (auto it = counts.begin(); it != counts.end(); ) {
+		it->second /= 2;
+		if (it->second == 0) {
+			it = counts.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+/**
+ * @param top_n How many paths to return.
+ * @returns The most-hit paths with their counts, hottest first.
+ */
+std::vector<std::pair<std::string, uint64_t>> HotFileManifest::hottest(size_t top_n) {
+	std::vector<std::pair<std::string, uint64_t>> entries;
+	{
+		std::lock_guard<std::mutex> lock(m);
+		entries.assign(counts.begin(), counts.end());
+	}
+	auto hotter = [](const std::pair<std::string, uint64_t> &a,
+			const std::pair<std::string, uint64_t> &b) {
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	};
+	top_n = std::min(top_n, entries.size());
+	std::partial_sort(entries.begin(), entries.begin() + top_n, entries.end(), hotter);
+	entries.resize(top_n);
+	return entries;
+}
+
+/**
+ * Writes the top_n hottest paths to the manifest. The manifest is written
+ * under a temporary name and renamed into place, so a crash mid-write never
+ * leaves a truncated manifest behind.
+ *
+ * @param manifest_file Where to save the manifest.
+ * @param top_n How many paths to keep.
+ * @returns false if the manifest couldn't be written.
+ */
+bool HotFileManifest::save(const std::string &manifest_file, size_t top_n) {
+	std::string tmp_file = manifest_file + ".tmp";
+	{
+		std::ofstream out(tmp_file, std::ios::trunc);
+		for (auto &entry : hottest(top_n)) {
+			out << entry.second << " " << entry.first << "\n";
+		}
+		out.flush();
+		if (!out) {
+			return false;
+		}
+	}
+	return rename(tmp_file.c_str(), manifest_file.c_str()) == 0;
+}
+
+/**
+ * Starts a (detached) thread that saves the manifest every interval.
+ *
+ * @param manifest_file Where to save the manifest.
+ * @param top_n How many paths to keep.
+ * @param interval Time between saves.
+ */
+void HotFileManifest::saveEvery(const std::string &manifest_file, size_t top_n,
+		std::chrono::seconds interval) {
+	std::thread saver([this, manifest_file, top_n, interval]() {
+		while (true) {
+			std::this_thread::sleep_for(interval);
+			if (!save(manifest_file, top_n)) {
+				perror("Saving hot-file manifest failed");
+			}
+		}
+	});
+	saver.detach();
+}
+
+/**
+ * Warms the caches for the top_n hottest paths, hottest first, using several
+ * threads (so the disk sees many requests at once). Each path is stat-ed,
+ * which pulls its dentries and inode into the kernel's caches; directories
+ * stand for their index.html. Regular files are then opened and read ahead
+ * with posix_fadvise(WILLNEED), until the byte budget runs out. Files that fit
+ * in the budget whole are passed to on_file; one that is only partly read
+ * ahead is not, since on_file may touch all of it. No new path is started
+ * once the time budget is spent.
+ *
+ * @param root The directory paths are relative to.
+ * @param top_n How many paths to warm at most.
+ * @param budget Threads to use, and time and bytes to spend.
+ * @param on_file Called (from the warm-up threads) with the full path of each
+ * regular file read ahead whole, for any in-process warming (e.g. mapping it).
+ * @returns What was done.
+ */
+WarmupResult HotFileManifest::prefetch(const std::string &root, size_t top_n,
+		const WarmupBudget &budget,
+		const std::function<void(const std::string &)> &on_file) {
+	std::vector<std::pair<std::string, uint64_t>> paths = hottest(top_n);
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + budget.time;
+
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> files(0);
+	std::atomic<uint64_t> bytes(0);
+	std::atomic<bool> out_of_time(false);
+
+	auto worker = [&]() {
+		while (true) {
+			size_t i = next++;
+			if (i >= paths.size()) {
+				return;
+			}
+			if (std::chrono::steady_clock::now() >= deadline) {
+				out_of_time = true;
+				return;
+			}
+
+			std::string full_path = root + paths[i].first;
+			struct stat st;
+			if (stat(full_path.c_str(), &st) < 0) {
+				continue;
+			}
+			if (S_ISDIR(st.st_mode)) {
+				full_path += "/index.html";
+				if (stat(full_path.c_str(), &st) < 0) {
+					continue;
+				}
+			}
+			files++;
+			if (!S_ISREG(st.st_mode)) {
+				continue;
+			}
+
+			uint64_t size = st.st_size;
+			uint64_t already = bytes.fetch_add(size);
+			if (already >= budget.bytes) {
+				bytes -= size;
+				continue;
+			}
+			bool trimmed = size > budget.bytes - already;
+			size = std::min(size, budget.bytes - already);
+			int fd = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd >= 0) {
+				posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+				close(fd);
+			}
+			if (!trimmed) {
+				on_file(full_path);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < std::max<size_t>(1, budget.threads); ++t) {
+		threads.emplace_back(worker);
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	WarmupResult result;
+	result.files = files;
+	result.bytes = std::min<uint64_t>(bytes, budget.bytes);
+	result.out_of_time = out_of_time;
+	result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start);
+	return result;
+}
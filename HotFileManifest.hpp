@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Limits on how much startup warm-up may do.
+ */
+struct WarmupBudget {
+	size_t threads = 8;
+	std::chrono::milliseconds time{ 2000 };
+	uint64_t bytes = 256 * 1024 * 1024; // of file data asked to be read ahead
+};
+
+/**
+ * What a warm-up did.
+ */
+struct WarmupResult {
+	size_t files = 0;   // paths stat-ed (including ones over the byte budget)
+	uint64_t bytes = 0; // bytes asked to be read ahead
+	bool out_of_time = false;
+	std::chrono::milliseconds elapsed{ 0 };
+};
+
+/**
+ * Hit counts for requested paths, persisted as a small manifest of the most
+ * popular ones ("count path" per line, hottest first) so that a restarted
+ * server can warm the kernel's dentry, inode, and page caches for them before
+ * it starts accepting connections.
+ *
+ * Counts are kept for at most max_tracked paths. When that fills up, every
+ * count is halved and paths that drop to zero are forgotten, so the table
+ * stays small and follows what is popular now rather than all time.
+ */
+class HotFileManifest {
+  public:
+	  HotFileManifest(size_t max_tracked = 4096);
+
+	  size_t load(const std::string &manifest_file);
+	  void record(const std::string &path);
+	  std::vector<std::pair<std::string, uint64_t>> hottest(size_t top_n);
+	  bool save(const std::string &manifest_file, size_t top_n);
+	  void saveEvery(const std::string &manifest_file, size_t top_n,
+			  std::chrono::seconds interval);
+
+	  WarmupResult prefetch(const std::string &root, size_t top_n,
+			  const WarmupBudget &budget,
+			  const std::function<void(const std::string &)> &on_file);
+
+  private:
+	  void decay();
+
+	  size_t max_tracked;
+	  std::mutex m;
+	  std::unordered_map<std::string, uint64_t> counts;
+};
@@ -0,0 +1,369 @@
+/**
+ * Implementation of the HpackDecoder and HpackEncoder classes.
+ * See the associated header file (Hpack.hpp) for the declarations.
+ */
+#include <memory>
+
+#include "Hpack.hpp"
+
+namespace {
+
+// Static table from RFC 7541 Appendix A (index 1 is the first entry).
+const std::pair<const char *, const char *> STATIC_TABLE[] = {
+	{":authority", ""}, {":method", "GET"}, {":method", "POST"},
+	{":path", "/"}, {":path", "/index.html"}, {":scheme", "http"},
+	{":scheme", "https"}, {":status", "200"}, {":status", "204"},
+	{":status", "206"}, {":status", "304"}, {":status", "400"},
+	{":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"}, {"accept-language", ""},
+	{"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+	{"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+	{"content-disposition", ""}, {"content-encoding", ""},
+	{"content-language", ""}, {"content-length", ""}, {"content-location", ""},
+	{"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+	{"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""},
+	{"if-match", ""}, {"if-modified-since", ""}, {"if-none-match", ""},
+	{"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+	{"link", ""}, {"location", ""}, {"max-forwards", ""},
+	{"proxy-authenticate", ""}, {"proxy-authorization", ""}, {"range", ""},
+	{"referer", ""}, {"refresh", ""}, {"retry-after", ""}, {"server", ""},
+	{"set-cookie", ""}, {"strict-transport-security", ""},
+	{"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+	{"www-authenticate", ""},
+};
+const size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+// Huffman code (right-aligned) and bit length for each symbol, RFC 7541
+// Appendix B. Symbol 256 is EOS.
+const struct { uint32_t code; uint8_t length; } HUFFMAN_CODES[257] = {
+	{0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+	{0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+	{0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+	{0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+	{0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+	{0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+	{0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+	{0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+	{0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+	{0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+	{0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+	{0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+	{0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+	{0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+	{0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+	{0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+	{0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+	{0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+	{0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+	{0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+	{0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+	{0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+	{0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+	{0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+	{0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+	{0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+	{0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+	{0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+	{0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+	{0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+	{0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+	{0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+	{0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+	{0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+	{0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+	{0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+	{0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+	{0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+	{0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+	{0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+	{0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+	{0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+	{0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+	{0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+	{0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+	{0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+	{0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+	{0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+	{0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+	{0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+	{0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+	{0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+	{0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+	{0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+	{0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+	{0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+	{0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+	{0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+	{0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+	{0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+	{0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+	{0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+	{0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+	{0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+	{0x3fffffff, 30}, // EOS
+};
+
+/**
+ * Binary tree for decoding Huffman-coded strings one bit at a time. Built
+ * once from HUFFMAN_CODES on first use.
+ */
+struct HuffmanNode {
+	int symbol = -1;
+	std::unique_ptr<HuffmanNode> children[2];
+};
+
+const HuffmanNode &huffmanTree() {
+	static const std::unique_ptr<HuffmanNode> root = []() {
+		auto tree = std::make_unique<HuffmanNode>();
+		for (int sym = 0; sym < 257; ++sym) {
+			HuffmanNode *node = tree.get();
+			for (int bit = HUFFMAN_CODES[sym].length - 1; bit >= 0; --bit) {
+				int b = (HUFFMAN_CODES[sym].code >> bit) & 1;
+				if (!node->children[b]) {
+					node->children[b] = std::make_unique<HuffmanNode>();
+				}
+				node = node->children[b].get();
+			}
+			node->symbol = sym;
+		}
+		return tree;
+	}();
+	return *root;
+}
+
+/**
+ * Decodes a Huffman-coded string.
+ *
+ * @param data The encoded bytes.
+ * @returns The decoded string.
+ */
+std::string huffmanDecode(const std::string &data) {
+	const HuffmanNode &root = huffmanTree();
+	const HuffmanNode *node = &root;
+	std::string out;
+	int pad_bits = 0; // bits read since the last complete symbol
+	bool pad_all_ones = true;
+
+	for (unsigned char c : data) {
+		for (int bit = 7; bit >= 0; --bit) {
+			int b = (c >> bit) & 1;
+			node = node->children[b].get();
+			if (node == nullptr) {
+				throw HpackError("invalid Huffman code");
+			}
+			pad_bits++;
+			pad_all_ones = pad_all_ones && b == 1;
+			if (node->symbol >= 0) {
+				if (node->symbol == 256) {
+					throw HpackError("EOS in Huffman string");
+				}
+				out.push_back((char) node->symbol);
+				node = &root;
+				pad_bits = 0;
+				pad_all_ones = true;
+			}
+		}
+	}
+	// Whatever is left over must be a short run of 1s (a prefix of EOS).
+	if (pad_bits > 7 || !pad_all_ones) {
+		throw HpackError("invalid Huffman padding");
+	}
+	return out;
+}
+
+/**
+ * Reads an HPACK integer with an N-bit prefix (RFC 7541 section 5.1).
+ *
+ * @param block The header block.
+ * @param pos Position of the prefix byte; advanced past the integer.
+ * @param prefix_bits Number of low bits of the first byte used.
+ * @returns The integer's value.
+ */
+uint64_t decodeInteger(const std::string &block, size_t &pos, int prefix_bits) {
+	if (pos >= block.size()) {
+		throw HpackError("truncated integer");
+	}
+	uint64_t max_prefix = (1u << prefix_bits) - 1;
+	uint64_t value = (unsigned char) block[pos++] & max_prefix;
+	if (value < max_prefix) {
+		return value;
+	}
+	for (int shift = 0; ; shift += 7) {
+		if (pos >= block.size() || shift > 28) {
+			throw HpackError("bad integer");
+		}
+		unsigned char b = block[pos++];
+		value += (uint64_t) (b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			return value;
+		}
+	}
+}
+
+/**
+ * Reads an HPACK string literal (RFC 7541 section 5.2).
+ *
+ * @param block The header block.
+ * @param pos Position of the length byte; advanced past the string.
+ * @returns The (Huffman-decoded, if needed) string.
+ */
+std::string decodeString(const std::string &block, size_t &pos) {
+	if (pos >= block.size()) {
+		throw HpackError("truncated string");
+	}
+	bool huffman = (block[pos] & 0x80) != 0;
+	uint64_t length = decodeInteger(block, pos, 7);
+	if (length > block.size() - pos) {
+		throw HpackError("string overruns block");
+	}
+	std::string raw = block.substr(pos, length);
+	pos += length;
+	return huffman ? huffmanDecode(raw) : raw;
+}
+
+/**
+ * Appends an HPACK integer with an N-bit prefix.
+ *
+ * @param out Where to append.
+ * @param first_byte High bits of the first byte (the representation flags).
+ * @param prefix_bits Number of low bits available in the first byte.
+ * @param value The integer to encode.
+ */
+void encodeInteger(std::string &out, unsigned char first_byte, int prefix_bits,
+		uint64_t value) {
+	uint64_t max_prefix = (1u << prefix_bits) - 1;
+	if (value < max_prefix) {
+		out.push_back((char) (first_byte | value));
+		return;
+	}
+	out.push_back((char) (first_byte | max_prefix));
+	value -= max_prefix;
+	while (value >= 128) {
+		out.push_back((char) ((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char) value);
+}
+
+} // namespace
+
+/**
+ * Constructor that sets the largest dynamic table we will allow (the
+ * SETTINGS_HEADER_TABLE_SIZE we advertise). The table starts out empty.
+ *
+ * @param max_table_size The dynamic table size limit in bytes.
+ */
+HpackDecoder::HpackDecoder(size_t max_table_size)
+	: max_table_size(max_table_size), table_size_limit(max_table_size),
+	table_size(0) {
+}
+
+/**
+ * Decodes a complete header block (HEADERS plus any CONTINUATION payloads).
+ *
+ * @param block The header block fragment(s), concatenated.
+ * @returns The headers in the order they appeared.
+ */
+HeaderList HpackDecoder::decode(const std::string &block) {
+	HeaderList headers;
+	size_t pos = 0;
+	while (pos < block.size()) {
+		unsigned char b = block[pos];
+		if (b & 0x80) { // indexed header field
+			headers.push_back(lookup(decodeInteger(block, pos, 7)));
+		}
+		else if ((b & 0xe0) == 0x20) { // dynamic table size update
+			uint64_t size = decodeInteger(block, pos, 5);
+			if (size > max_table_size) {
+				throw HpackError("table size update over limit");
+			}
+			table_size_limit = size;
+			evict();
+		}
+		else {
+			// literal: with incremental indexing (01), without (0000), or
+			// never indexed (0001)
+			bool index = (b & 0xc0) == 0x40;
+			uint64_t name_index = decodeInteger(block, pos, index ? 6 : 4);
+			std::string name = name_index ? lookup(name_index).first
+				: decodeString(block, pos);
+			std::string value = decodeString(block, pos);
+			if (index) {
+				insert(name, value);
+			}
+			headers.emplace_back(std::move(name), std::move(value));
+		}
+	}
+	return headers;
+}
+
+/**
+ * Looks up a header by its index into the combined static + dynamic table.
+ */
+std::pair<std::string, std::string> HpackDecoder::lookup(uint64_t index) const {
+	if (index == 0) {
+		throw HpackError("index 0");
+	}
+	if (index <= STATIC_TABLE_SIZE) {
+		return { STATIC_TABLE[index - 1].first, STATIC_TABLE[index - 1].second };
+	}
+	index -= STATIC_TABLE_SIZE + 1;
+	if (index >= dynamic_table.size()) {
+		throw HpackError("index past end of table");
+	}
+	return dynamic_table[index];
+}
+
+void HpackDecoder::insert(const std::string &name, const std::string &value) {
+	dynamic_table.emplace_front(name, value);
+	table_size += name.size() + value.size() + 32;
+	evict();
+}
+
+/**
+ * Drops the oldest entries until the table fits in its current size limit.
+ */
+void HpackDecoder::evict() {
+	while (table_size > table_size_limit && !dynamic_table.empty()) {
+		const auto &oldest = dynamic_table.back();
+		table_size -= oldest.first.size() + oldest.second.size() + 32;
+		dynamic_table.pop_back();
+	}
+}
+
+/**
+ * Encodes headers as literals without indexing, using a static table name
+ * index when there is one.
+ *
+ * @param headers Header names must already be lowercase.
+ * @returns The header block.
+ */
+std::string HpackEncoder::encode(const HeaderList &headers) const {
+	std::string out;
+	for (const auto &header : headers) {
+		size_t name_index = 0;
+		for (size_t i = 0; i < STATIC_TABLE_SIZE; ++i) {
+			if (header.first == STATIC_TABLE[i].first) {
+				if (header.second == STATIC_TABLE[i].second) {
+					name_index = i + 1;
+					break;
+				}
+				if (name_index == 0) {
+					name_index = i + 1;
+				}
+			}
+		}
+		if (name_index != 0 && header.second == STATIC_TABLE[name_index - 1].second) {
+			encodeInteger(out, 0x80, 7, name_index); // fully indexed
+			continue;
+		}
+		encodeInteger(out, 0x00, 4, name_index);
+		if (name_index == 0) {
+			encodeInteger(out, 0x00, 7, header.first.size());
+			out += header.first;
+		}
+		encodeInteger(out, 0x00, 7, header.second.size());
+		out += header.second;
+	}
+	return out;
+}
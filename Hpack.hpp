@@ -0,0 +1,48 @@
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * Thrown when a header block can't be decoded. HTTP/2 treats this as a
+ * connection error (COMPRESSION_ERROR).
+ */
+class HpackError : public std::runtime_error {
+  public:
+	  explicit HpackError(const std::string &what) : std::runtime_error(what) {}
+};
+
+/**
+ * HPACK (RFC 7541) header block decoder. One decoder belongs to each HTTP/2
+ * connection, since the dynamic table is connection state.
+ */
+class HpackDecoder {
+  public:
+	  HpackDecoder(size_t max_table_size);
+
+	  HeaderList decode(const std::string &block);
+
+  private:
+	  std::pair<std::string, std::string> lookup(uint64_t index) const;
+	  void insert(const std::string &name, const std::string &value);
+	  void evict();
+
+	  size_t max_table_size; // limit we advertised in SETTINGS
+	  size_t table_size_limit; // limit the peer chose (<= max_table_size)
+	  size_t table_size;
+	  std::deque<std::pair<std::string, std::string>> dynamic_table; // newest first
+};
+
+/**
+ * HPACK header block encoder. It never adds to the dynamic table (only
+ * static table names and plain literals), so it is stateless and one
+ * instance can be shared.
+ */
+class HpackEncoder {
+  public:
+	  std::string encode(const HeaderList &headers) const;
+};
@@ -0,0 +1,722 @@
+/**
+ * Implementation of the Http2Connection class.
+ * See the associated header file (Http2Connection.hpp) for the declaration
+ * of this class.
+ */
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <system_error>
+#include <thread>
+
+#include "ClientLimiter.hpp"
+#include "Http2Connection.hpp"
+
+namespace {
+
+const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t PREFACE_LENGTH = sizeof(PREFACE) - 1;
+
+// Close a connection whose streams have made no progress (no new request and
+// no DATA sent) for this long, since it holds on to one of the worker
+// threads. Control frames such as PING don't count as progress.
+const std::chrono::milliseconds IDLE_TIMEOUT(5000);
+const uint32_t MAX_CONCURRENT_STREAMS = 100;
+const uint32_t OUR_MAX_FRAME_SIZE = 16384; // the default; we never raise it
+const size_t HEADER_TABLE_SIZE = 4096;
+// Largest request header block we'll buffer across CONTINUATION frames.
+const size_t MAX_HEADER_BLOCK = 64 * 1024;
+
+// frame types
+const uint8_t DATA = 0x0;
+const uint8_t HEADERS = 0x1;
+const uint8_t PRIORITY = 0x2;
+const uint8_t RST_STREAM = 0x3;
+const uint8_t SETTINGS = 0x4;
+const uint8_t PING = 0x6;
+const uint8_t GOAWAY = 0x7;
+const uint8_t WINDOW_UPDATE = 0x8;
+const uint8_t CONTINUATION = 0x9;
+
+// frame flags
+const uint8_t END_STREAM = 0x1;
+const uint8_t ACK = 0x1;
+const uint8_t END_HEADERS = 0x4;
+const uint8_t PADDED = 0x8;
+const uint8_t PRIORITY_FLAG = 0x20;
+
+// error codes
+const uint32_t NO_ERROR = 0x0;
+const uint32_t PROTOCOL_ERROR = 0x1;
+const uint32_t INTERNAL_ERROR = 0x2;
+const uint32_t FLOW_CONTROL_ERROR = 0x3;
+const uint32_t FRAME_SIZE_ERROR = 0x6;
+const uint32_t REFUSED_STREAM = 0x7;
+const uint32_t COMPRESSION_ERROR = 0x9;
+const uint32_t ENHANCE_YOUR_CALM = 0xb;
+const uint32_t HTTP_1_1_REQUIRED = 0xd;
+
+/**
+ * A connection error; the connection is closed with a GOAWAY carrying code.
+ */
+struct Http2Error {
+	uint32_t code;
+};
+
+uint32_t readUint32(const std::string &s, size_t pos) {
+	return ((uint32_t) (unsigned char) s[pos] << 24)
+		| ((uint32_t) (unsigned char) s[pos + 1] << 16)
+		| ((uint32_t) (unsigned char) s[pos + 2] << 8)
+		| (uint32_t) (unsigned char) s[pos + 3];
+}
+
+void appendUint32(std::string &s, uint32_t value) {
+	s.push_back((char) (value >> 24));
+	s.push_back((char) (value >> 16));
+	s.push_back((char) (value >> 8));
+	s.push_back((char) value);
+}
+
+/**
+ * Decodes the base64url (no padding) value of an HTTP2-Settings header.
+ *
+ * @param in The header value.
+ * @returns The raw SETTINGS payload.
+ */
+std::string base64UrlDecode(const std::string &in) {
+	std::string out;
+	uint32_t bits = 0;
+	int bit_count = 0;
+	for (char c : in) {
+		int v;
+		if (c >= 'A' && c <= 'Z') v = c - 'A';
+		else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') v = c - '0' + 52;
+		else if (c == '-' || c == '+') v = 62;
+		else if (c == '_' || c == '/') v = 63;
+		else continue; // '=' padding or whitespace
+		bits = (bits << 6) | v;
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			out.push_back((char) ((bits >> bit_count) & 0xff));
+		}
+	}
+	return out;
+}
+
+} // namespace
+
+/**
+ * Constructor for a connection on an already accepted socket.
+ *
+ * @param sock The client's socket file descriptor (not closed by this class).
+ * @param handler Produces the response for each request.
+ * @param sender Sends frames on sock (by default, plain send calls).
+ * @param shaper Paces DATA frames (nullptr for no pacing).
+ */
+Http2Connection::Http2Connection(int sock, Http2Handler handler,
+		Http2Sender sender, SendShaper *shaper)
+	: sock(sock), handler(std::move(handler)), sender(std::move(sender)),
+	  shaper(shaper), decoder(HEADER_TABLE_SIZE),
+	  last_activity(std::chrono::steady_clock::now()) {
+}
+
+/**
+ * Checks whether data could be the start of the HTTP/2 connection preface.
+ *
+ * @param data The first bytes received on a connection.
+ * @returns true if data is non-empty and matches the preface so far.
+ */
+bool Http2Connection::startsWithPreface(const std::string &data) {
+	size_t n = std::min(data.size(), PREFACE_LENGTH);
+	return n > 0 && data.compare(0, n, PREFACE, n) == 0;
+}
+
+/**
+ * Serves a prior-knowledge connection until it is closed or goes idle.
+ *
+ * @param already_received Bytes already read from the socket (starting with
+ * the connection preface).
+ */
+void Http2Connection::serve(const std::string &already_received) {
+	in = already_received;
+	queueSettings();
+	run();
+}
+
+/**
+ * Serves a connection that was upgraded from HTTP/1.1. The upgrading request
+ * becomes stream 1, which is answered once our SETTINGS are out.
+ *
+ * @param method The upgrading request's method.
+ * @param path The upgrading request's path.
+ * @param http2_settings The request's HTTP2-Settings header value.
+ */
+void Http2Connection::serveUpgrade(const std::string &method,
+		const std::string &path, const std::string &http2_settings) {
+	queueSettings();
+	try {
+		applySettings(base64UrlDecode(http2_settings));
+	}
+	catch (const Http2Error &e) {
+		goAway(e.code);
+		return;
+	}
+	last_stream_id = 1;
+	respond(1, method, path);
+	run();
+}
+
+/**
+ * Turns away a prior-knowledge connection (e.g. because too many are open),
+ * telling the client to retry over HTTP/1.1.
+ */
+void Http2Connection::refuse() {
+	queueSettings();
+	goAway(HTTP_1_1_REQUIRED);
+}
+
+/**
+ * Queues our SETTINGS frame, which must be the first frame we send. It tells
+ * the client how many streams it may open at once.
+ */
+void Http2Connection::queueSettings() {
+	std::string settings;
+	settings.push_back(0);
+	settings.push_back(0x3); // SETTINGS_MAX_CONCURRENT_STREAMS
+	appendUint32(settings, MAX_CONCURRENT_STREAMS);
+	queueFrame(SETTINGS, 0, 0, settings);
+}
+
+/**
+ * Reads, handles, and writes frames until the connection ends.
+ */
+void Http2Connection::run() {
+	try {
+		flush();
+		while (!closing) {
+			if (!processFrames()) {
+				break;
+			}
+			flush();
+			if (goaway_received && streams.empty()) {
+				break;
+			}
+
+			bool pending = std::any_of(streams.begin(), streams.end(),
+					[this](const auto &s) { return sendable(s.second); });
+
+			auto idle_left = IDLE_TIMEOUT - (std::chrono::steady_clock::now() - last_activity);
+			if (!pending && idle_left <= std::chrono::milliseconds(0)) {
+				goAway(NO_ERROR); // idle
+				break;
+			}
+
+			struct pollfd pfd = { sock, POLLIN, 0 };
+			int timeout_ms = pending ? 0 : std::chrono::duration_cast<
+				std::chrono::milliseconds>(idle_left).count() + 1;
+			int ready = poll(&pfd, 1, timeout_ms);
+			if (ready < 0 && errno != EINTR) {
+				break;
+			}
+			if (ready > 0) {
+				char buf[16384];
+				ssize_t n = recv(sock, buf, sizeof(buf), 0);
+				if (n <= 0) {
+					break; // peer closed (or reset) the connection
+				}
+				in.append(buf, n);
+			}
+
+			if (pending) {
+				sendRound();
+			}
+		}
+	}
+	catch (const std::system_error &e) {
+		// send failed: the peer is gone, so there is nobody to tell
+	}
+}
+
+/**
+ * Handles every complete frame in the receive buffer.
+ *
+ * @returns false if the connection hit an error and was closed.
+ */
+bool Http2Connection::processFrames() {
+	size_t pos = 0;
+	if (!preface_seen) {
+		if (in.size() < PREFACE_LENGTH) {
+			if (!startsWithPreface(in) && !in.empty()) {
+				goAway(PROTOCOL_ERROR);
+				return false;
+			}
+			return true;
+		}
+		if (in.compare(0, PREFACE_LENGTH, PREFACE) != 0) {
+			goAway(PROTOCOL_ERROR);
+			return false;
+		}
+		preface_seen = true;
+		pos = PREFACE_LENGTH;
+	}
+
+	try {
+		while (in.size() - pos >= 9) {
+			uint32_t length = readUint32(in, pos) >> 8;
+			if (length > OUR_MAX_FRAME_SIZE) {
+				throw Http2Error{ FRAME_SIZE_ERROR };
+			}
+			if (in.size() - pos < 9 + length) {
+				break;
+			}
+			uint8_t type = in[pos + 3];
+			uint8_t flags = in[pos + 4];
+			uint32_t stream_id = readUint32(in, pos + 5) & 0x7fffffff;
+			std::string payload = in.substr(pos + 9, length);
+			pos += 9 + length;
+			handleFrame(type, flags, stream_id, payload);
+		}
+	}
+	catch (const Http2Error &e) {
+		goAway(e.code);
+		return false;
+	}
+	catch (const HpackError &e) {
+		goAway(COMPRESSION_ERROR);
+		return false;
+	}
+	in.erase(0, pos);
+	return true;
+}
+
+/**
+ * Dispatches one frame.
+ *
+ * @param type The frame type.
+ * @param flags The frame flags.
+ * @param stream_id The stream the frame belongs to (0 for the connection).
+ * @param payload The frame payload.
+ */
+void Http2Connection::handleFrame(uint8_t type, uint8_t flags,
+		uint32_t stream_id, const std::string &payload) {
+	// A header block must be finished before anything else is sent.
+	if (continuation_stream != 0
+			&& (type != CONTINUATION || stream_id != continuation_stream)) {
+		throw Http2Error{ PROTOCOL_ERROR };
+	}
+
+	switch (type) {
+	case SETTINGS:
+		if (stream_id != 0) {
+			throw Http2Error{ PROTOCOL_ERROR };
+		}
+		if (!(flags & ACK)) {
+			applySettings(payload);
+			queueFrame(SETTINGS, ACK, 0, "");
+		}
+		break;
+
+	case PING:
+		if (payload.size() != 8) {
+			throw Http2Error{ FRAME_SIZE_ERROR };
+		}
+		if (!(flags & ACK)) {
+			queueFrame(PING, ACK, 0, payload);
+		}
+		break;
+
+	case WINDOW_UPDATE: {
+		if (payload.size() != 4) {
+			throw Http2Error{ FRAME_SIZE_ERROR };
+		}
+		uint32_t increment = readUint32(payload, 0) & 0x7fffffff;
+		if (stream_id == 0) {
+			if (increment == 0) {
+				throw Http2Error{ PROTOCOL_ERROR };
+			}
+			connection_window += increment;
+			if (connection_window > 0x7fffffff) {
+				throw Http2Error{ FLOW_CONTROL_ERROR };
+			}
+		}
+		else if (stream_id > last_stream_id) {
+			throw Http2Error{ PROTOCOL_ERROR }; // stream was never opened
+		}
+		else if (increment == 0) {
+			resetStream(stream_id, PROTOCOL_ERROR);
+		}
+		else {
+			auto it = streams.find(stream_id);
+			if (it != streams.end()) {
+				it->second.send_window += increment;
+				if (it->second.send_window > 0x7fffffff) {
+					resetStream(stream_id, FLOW_CONTROL_ERROR);
+				}
+			}
+		}
+		break;
+	}
+
+	case HEADERS: {
+		if (stream_id == 0 || stream_id % 2 == 0) {
+			throw Http2Error{ PROTOCOL_ERROR };
+		}
+		size_t start = 0, end = payload.size();
+		if (flags & PADDED) {
+			if (payload.empty() || (unsigned char) payload[0] >= payload.size()) {
+				throw Http2Error{ PROTOCOL_ERROR };
+			}
+			end -= (unsigned char) payload[0];
+			start = 1;
+		}
+		if (flags & PRIORITY_FLAG) {
+			start += 5; // stream dependency + weight; scheduling is round-robin
+		}
+		if (start > end) {
+			throw Http2Error{ PROTOCOL_ERROR };
+		}
+		header_block = payload.substr(start, end - start);
+		if (flags & END_HEADERS) {
+			handleHeaders(stream_id, header_block);
+		}
+		else {
+			continuation_stream = stream_id;
+		}
+		break;
+	}
+
+	case CONTINUATION:
+		if (continuation_stream == 0) {
+			throw Http2Error{ PROTOCOL_ERROR };
+		}
+		if (header_block.size() + payload.size() > MAX_HEADER_BLOCK) {
+			throw Http2Error{ ENHANCE_YOUR_CALM };
+		}
+		header_block += payload;
+		if (flags & END_HEADERS) {
+			continuation_stream = 0;
+			handleHeaders(stream_id, header_block);
+		}
+		break;
+
+	case DATA:
+		if (stream_id == 0 || stream_id > last_stream_id) {
+			throw Http2Error{ PROTOCOL_ERROR }; // not on an opened stream
+		}
+		// We don't take request bodies, but still hand back the flow-control
+		// credit so the client never stalls.
+		if (!payload.empty()) {
+			std::string increment;
+			appendUint32(increment, payload.size());
+			queueFrame(WINDOW_UPDATE, 0, 0, increment);
+			if (streams.count(stream_id) && !(flags & END_STREAM)) {
+				queueFrame(WINDOW_UPDATE, 0, stream_id, increment);
+			}
+		}
+		break;
+
+	case RST_STREAM:
+		streams.erase(stream_id);
+		break;
+
+	case GOAWAY:
+		// Finish what's in flight, then close.
+		goaway_received = true;
+		break;
+
+	case PRIORITY:
+	default:
+		break; // ignored (unknown frame types must be ignored)
+	}
+}
+
+/**
+ * Applies a SETTINGS payload from the client.
+ *
+ * @param payload Zero or more 6-byte (id, value) pairs.
+ */
+void Http2Connection::applySettings(const std::string &payload) {
+	if (payload.size() % 6 != 0) {
+		throw Http2Error{ FRAME_SIZE_ERROR };
+	}
+	for (size_t pos = 0; pos < payload.size(); pos += 6) {
+		uint16_t id = ((unsigned char) payload[pos] << 8) | (unsigned char) payload[pos + 1];
+		uint32_t value = readUint32(payload, pos + 2);
+		if (id == 0x4) { // SETTINGS_INITIAL_WINDOW_SIZE
+			if (value > 0x7fffffff) {
+				throw Http2Error{ FLOW_CONTROL_ERROR };
+			}
+			int64_t delta = (int64_t) value - initial_window;
+			initial_window = value;
+			for (auto &s : streams) {
+				s.second.send_window += delta;
+				if (s.second.send_window > 0x7fffffff) {
+					throw Http2Error{ FLOW_CONTROL_ERROR };
+				}
+			}
+		}
+		else if (id == 0x5) { // SETTINGS_MAX_FRAME_SIZE
+			if (value < 16384 || value > 16777215) {
+				throw Http2Error{ PROTOCOL_ERROR };
+			}
+			max_frame_size = value;
+		}
+		// HEADER_TABLE_SIZE doesn't matter since our encoder never indexes;
+		// the rest don't apply to a server.
+	}
+}
+
+/**
+ * Decodes a complete request header block and answers the request.
+ *
+ * @param stream_id The stream the request arrived on.
+ * @param block The complete header block.
+ */
+void Http2Connection::handleHeaders(uint32_t stream_id, const std::string &block) {
+	HeaderList headers = decoder.decode(block); // always decode: updates table state
+	if (stream_id <= last_stream_id) {
+		return; // trailers on a stream we've already answered
+	}
+	last_stream_id = stream_id;
+
+	if (streams.size() >= MAX_CONCURRENT_STREAMS) {
+		resetStream(stream_id, REFUSED_STREAM);
+		return;
+	}
+
+	std::string method, path;
+	for (const auto &header : headers) {
+		if (header.first == ":method") {
+			method = header.second;
+		}
+		else if (header.first == ":path") {
+			path = header.second;
+		}
+	}
+	respond(stream_id, method, path);
+}
+
+/**
+ * Queues the HEADERS for a response and, if it has a body, starts streaming
+ * it on the next rounds.
+ *
+ * @param stream_id The stream to answer on.
+ * @param method The request's method.
+ * @param path The request's path.
+ */
+void Http2Connection::respond(uint32_t stream_id, const std::string &method,
+		const std::string &path) {
+	last_activity = std::chrono::steady_clock::now();
+	Http2Response response = handler(method, path);
+	bool streamed = response.file_name.empty() && response.body_source;
+
+	Stream stream;
+	stream.send_window = initial_window;
+	if (method == "HEAD") {
+		// headers only
+	}
+	else if (!response.file_name.empty()) {
+		stream.file = std::make_unique<std::ifstream>(response.file_name, std::ios::binary);
+		stream.remaining = response.content_length;
+	}
+	else if (streamed) {
+		stream.source = std::move(response.body_source);
+		if (!pull(stream)) { // failed before anything was sent
+			response.status = 500;
+			response.content_length = 0;
+			streamed = false;
+		}
+	}
+	else {
+		stream.body = std::move(response.body);
+		stream.remaining = response.content_length;
+	}
+	bool has_body = stream.remaining > 0;
+
+	HeaderList headers = { { ":status", std::to_string(response.status) } };
+	if (!streamed) {
+		headers.emplace_back("content-length", std::to_string(response.content_length));
+	}
+	if (!response.content_type.empty()) {
+		headers.emplace_back("content-type", response.content_type);
+	}
+	queueFrame(HEADERS, END_HEADERS | (has_body ? 0 : END_STREAM), stream_id,
+			encoder.encode(headers));
+	if (!has_body) {
+		return;
+	}
+
+	streams[stream_id] = std::move(stream);
+	send_order.push_back(stream_id);
+}
+
+/**
+ * Refills a streamed body from its source once all of what was pulled has
+ * been sent. When the source runs dry it is dropped, leaving remaining at 0.
+ *
+ * @returns false if the source failed (e.g. the directory went away).
+ */
+bool Http2Connection::pull(Stream &stream) {
+	try {
+		while (stream.source && stream.remaining == 0) {
+			stream.body_pos = 0;
+			if (!stream.source(stream.body)) {
+				stream.source = nullptr;
+				stream.body.clear();
+			}
+			stream.remaining = stream.body.size();
+		}
+	}
+	catch (const std::exception &e) {
+		stream.source = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @returns true if the stream has body left and window to send some of it.
+ */
+bool Http2Connection::sendable(const Stream &stream) const {
+	return stream.remaining > 0 && stream.send_window > 0 && connection_window > 0;
+}
+
+/**
+ * Sends at most one DATA frame for each stream with data to send, in
+ * round-robin order, then flushes them together.
+ */
+void Http2Connection::sendRound() {
+	size_t rounds = send_order.size();
+	for (size_t i = 0; i < rounds && connection_window > 0; ++i) {
+		uint32_t id = send_order.front();
+		send_order.pop_front();
+		auto it = streams.find(id);
+		if (it == streams.end()) {
+			continue; // reset by the client
+		}
+		Stream &stream = it->second;
+		if (!sendable(stream)) {
+			send_order.push_back(id); // waiting on a WINDOW_UPDATE
+			continue;
+		}
+
+		size_t length = std::min<uint64_t>({ max_frame_size, stream.remaining,
+				(uint64_t) stream.send_window, (uint64_t) connection_window });
+		if (shaper != nullptr && shaper->limited()) {
+			length = shaper->chunkSize(length);
+			auto delay = shaper->reserve(length);
+			if (delay.count() > 0) {
+				flush(); // don't hold back frames already queued while we wait
+				std::this_thread::sleep_for(delay);
+			}
+		}
+		std::string chunk;
+		if (stream.file) {
+			chunk.resize(length);
+			stream.file->read(&chunk[0], length);
+			if ((size_t) stream.file->gcount() != length) {
+				// file shrank after we sent its content-length
+				resetStream(id, INTERNAL_ERROR);
+				continue;
+			}
+		}
+		else {
+			chunk = stream.body.substr(stream.body_pos, length);
+			stream.body_pos += length;
+		}
+
+		stream.remaining -= length;
+		stream.send_window -= length;
+		connection_window -= length;
+		last_activity = std::chrono::steady_clock::now();
+		bool failed = !pull(stream);
+		bool done = !failed && stream.remaining == 0;
+		queueFrame(DATA, done ? END_STREAM : 0, id, chunk);
+		if (failed) {
+			resetStream(id, INTERNAL_ERROR); // after the body we did send
+		}
+		else if (done) {
+			streams.erase(it);
+		}
+		else {
+			send_order.push_back(id);
+		}
+	}
+	flush();
+}
+
+/**
+ * Appends a frame to the output buffer (sent on the next flush).
+ */
+void Http2Connection::queueFrame(uint8_t type, uint8_t flags,
+		uint32_t stream_id, const std::string &payload) {
+	appendUint32(out, (payload.size() << 8) | type);
+	out.push_back((char) flags);
+	appendUint32(out, stream_id);
+	out += payload;
+}
+
+/**
+ * Sends everything queued, raising an exception if there was a problem
+ * sending.
+ */
+void Http2Connection::flush() {
+	if (sender) {
+		std::string frames;
+		frames.swap(out);
+		sender(frames.data(), frames.size());
+		return;
+	}
+	const char *data = out.data();
+	size_t length = out.size();
+	while (length > 0) {
+		ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+		if (sent == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::error_code ec(errno, std::generic_category());
+			throw std::system_error(ec, "send failed");
+		}
+		length -= sent;
+		data += sent;
+	}
+	out.clear();
+}
+
+/**
+ * Queues an RST_STREAM and forgets the stream.
+ *
+ * @param stream_id The stream to reset.
+ * @param error_code Why the stream is being reset.
+ */
+void Http2Connection::resetStream(uint32_t stream_id, uint32_t error_code) {
+	std::string code;
+	appendUint32(code, error_code);
+	queueFrame(RST_STREAM, 0, stream_id, code);
+	streams.erase(stream_id);
+}
+
+/**
+ * Sends a GOAWAY and marks the connection as closing.
+ *
+ * @param error_code Why the connection is going away.
+ */
+void Http2Connection::goAway(uint32_t error_code) {
+	std::string payload;
+	appendUint32(payload, last_stream_id);
+	appendUint32(payload, error_code);
+	queueFrame(GOAWAY, 0, 0, payload);
+	closing = true;
+	try {
+		flush();
+	}
+	catch (const std::system_error &e) {
+	}
+}
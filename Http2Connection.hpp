@@ -0,0 +1,118 @@
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "Hpack.hpp"
+
+class SendShaper;
+
+// Produces a body of unknown length a piece at a time: sets chunk to the next
+// piece and returns true, or returns false once there is no more.
+using Http2BodySource = std::function<bool(std::string &chunk)>;
+
+/**
+ * What to send back for one HTTP/2 request. Small bodies (error pages) are
+ * passed in memory; files are streamed from disk, and generated bodies
+ * (directory listings) from a body_source, in DATA frames as flow control
+ * allows.
+ */
+struct Http2Response {
+	int status = 200;
+	std::string content_type;
+	std::string body;      // sent as-is when file_name and body_source are empty
+	std::string file_name; // otherwise the body is read from this file
+	Http2BodySource body_source; // or pulled from this (with no content-length)
+	uint64_t content_length = 0;
+};
+
+// Maps a request's :method and :path to its response.
+using Http2Handler = std::function<Http2Response(const std::string &method,
+		const std::string &path)>;
+// Sends all of the given bytes, throwing std::system_error if it can't.
+using Http2Sender = std::function<void(const char *data, size_t length)>;
+
+/**
+ * One cleartext HTTP/2 (h2c) connection, served to completion on the calling
+ * thread.
+ *
+ * Requests on any number of streams (up to MAX_CONCURRENT_STREAMS) are
+ * answered concurrently: response bodies are sent one DATA frame per stream
+ * per round, so a large file never holds up a small one behind it, and every
+ * frame respects both the stream and connection flow-control windows. If a
+ * SendShaper is given, DATA frames are also paced to its rate.
+ */
+class Http2Connection {
+  public:
+	  Http2Connection(int sock, Http2Handler handler, Http2Sender sender = nullptr,
+			  SendShaper *shaper = nullptr);
+
+	  // Client sent the connection preface directly ("prior knowledge").
+	  void serve(const std::string &already_received);
+	  // Client upgraded from HTTP/1.1; the 101 response has already been sent.
+	  void serveUpgrade(const std::string &method, const std::string &path,
+			  const std::string &http2_settings);
+
+	  // Too many connections: send GOAWAY asking the client to use HTTP/1.1.
+	  void refuse();
+
+	  static bool startsWithPreface(const std::string &data);
+
+  private:
+	  struct Stream {
+		  int64_t send_window;
+		  std::string body;
+		  size_t body_pos = 0;
+		  std::unique_ptr<std::ifstream> file;
+		  Http2BodySource source; // refills body once it has all been sent
+		  uint64_t remaining = 0; // for a source, what's left of body
+	  };
+
+	  void queueSettings();
+	  void run();
+	  bool processFrames();
+	  void handleFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+			  const std::string &payload);
+	  void applySettings(const std::string &payload);
+	  void handleHeaders(uint32_t stream_id, const std::string &block);
+	  void respond(uint32_t stream_id, const std::string &method,
+			  const std::string &path);
+	  bool pull(Stream &stream);
+	  bool sendable(const Stream &stream) const;
+	  void sendRound();
+
+	  void queueFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+			  const std::string &payload);
+	  void flush();
+	  void resetStream(uint32_t stream_id, uint32_t error_code);
+	  void goAway(uint32_t error_code);
+
+	  int sock;
+	  Http2Handler handler;
+	  Http2Sender sender; // if empty, frames are sent straight to sock
+	  SendShaper *shaper;
+	  HpackDecoder decoder;
+	  HpackEncoder encoder;
+
+	  std::string in;  // received bytes not yet parsed into frames
+	  std::string out; // frames queued for the next flush
+	  bool preface_seen = false;
+	  bool closing = false;
+	  bool goaway_received = false;
+	  std::chrono::steady_clock::time_point last_activity; // for the idle timeout
+
+	  int64_t connection_window = 65535;
+	  int64_t initial_window = 65535;
+	  uint32_t max_frame_size = 16384;
+	  uint32_t last_stream_id = 0;
+
+	  uint32_t continuation_stream = 0; // stream whose header block is open
+	  std::string header_block;
+
+	  std::map<uint32_t, Stream> streams;
+	  std::deque<uint32_t> send_order; // round-robin order of streams with data
+};
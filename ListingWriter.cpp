@@ -0,0 +1,150 @@
+/**
+ * Implementation of the ListingWriter class.
+ * See the associated header file (ListingWriter.hpp) for the declaration of
+ * this class.
+ */
+#include <cctype>
+
+#include <algorithm>
+#include <queue>
+
+#include "ListingWriter.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/**
+ * Percent-encodes everything but unreserved characters (RFC 3986), so a name
+ * can go in a next-page link's query string.
+ */
+std::string percentEncode(const std::string &value) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string encoded;
+	for (unsigned char c : value) {
+		if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+			encoded += c;
+		}
+		else {
+			encoded += '%';
+			encoded += hex[c >> 4];
+			encoded += hex[c & 0xf];
+		}
+	}
+	return encoded;
+}
+
+} // namespace
+
+/**
+ * Constructor that only records what to list: the directory isn't opened
+ * until the first call to next.
+ *
+ * @param dir_name The directory to list.
+ * @param page Which part of the listing to generate.
+ * @param chunk_size Roughly how many bytes to hand out per call to next.
+ */
+ListingWriter::ListingWriter(std::string dir_name, ListingPage page,
+		size_t chunk_size)
+	: dir_name(std::move(dir_name)), page(std::move(page)),
+	  chunk_size(chunk_size), started(false), finished(false), sorted_pos(0),
+	  more_pages(false) {
+}
+
+/**
+ * Produces the next piece of the listing. This reads the directory, so it
+ * may block; errors reading it come out as std::filesystem::filesystem_error.
+ *
+ * @param chunk Set to the next piece (of roughly chunk_size bytes).
+ * @returns false once the whole listing has been handed out.
+ */
+bool ListingWriter::next(std::string &chunk) {
+	chunk.clear();
+	if (finished) {
+		return false;
+	}
+	if (!started) {
+		started = true;
+		chunk = "<html>\r\n<head><title></title></head>\r\n<body>\r\n<ul>\r\n"; //Making auto-generated bulleted list
+		entries = fs::directory_iterator(dir_name);
+		if (page.paginated) {
+			sortPage();
+		}
+	}
+
+	if (!page.paginated) {
+		for (; entries != fs::directory_iterator() && chunk.length() < chunk_size; ++entries) {
+			if (entries->is_regular_file()) { //Check for filenames and add in all files
+				append(entries->path().filename().string(), false, chunk);
+			}
+			else if (entries->is_directory()) {
+				append(entries->path().filename().string(), true, chunk);
+			}
+		}
+		if (entries == fs::directory_iterator()) {
+			chunk += "</ul>\r\n</body>\r\n</html>\r\n";
+			finished = true;
+		}
+		return true;
+	}
+
+	for (; sorted_pos < sorted.size() && chunk.length() < chunk_size; ++sorted_pos) {
+		append(sorted[sorted_pos].first, sorted[sorted_pos].second, chunk);
+	}
+	if (sorted_pos == sorted.size()) {
+		chunk += "</ul>\r\n";
+		if (more_pages) {
+			chunk += "<a href=\"?after=" + percentEncode(sorted.back().first)
+				+ "&limit=" + std::to_string(page.limit) + "\">Next page</a>\r\n";
+		}
+		chunk += "</body>\r\n</html>\r\n";
+		finished = true;
+	}
+	return true;
+}
+
+/**
+ * Reads the whole directory, keeping the page's names in sorted order.
+ */
+void ListingWriter::sortPage() {
+	// Max-heap holding the offset + limit smallest names after the cursor so
+	// far.
+	size_t window = page.offset + page.limit;
+	std::priority_queue<std::pair<std::string, bool>> smallest;
+	for (; entries != fs::directory_iterator(); ++entries) {
+		bool is_dir = entries->is_directory();
+		if (!is_dir && !entries->is_regular_file()) {
+			continue;
+		}
+		std::string name = entries->path().filename().string();
+		if (name <= page.after) {
+			continue;
+		}
+		if (smallest.size() == window && name >= smallest.top().first) {
+			more_pages = true; //wouldn't make this page, skip the copy
+			continue;
+		}
+		smallest.emplace(std::move(name), is_dir);
+		if (smallest.size() > window) {
+			smallest.pop();
+			more_pages = true;
+		}
+	}
+
+	sorted.reserve(smallest.size());
+	while (!smallest.empty()) {
+		sorted.push_back(smallest.top());
+		smallest.pop();
+	}
+	std::reverse(sorted.begin(), sorted.end()); //heap came out largest first
+	sorted_pos = std::min(page.offset, sorted.size());
+}
+
+/**
+ * Adds one list item linking to a name (with a trailing slash for
+ * directories).
+ */
+void ListingWriter::append(const std::string &name, bool is_dir, std::string &chunk) {
+	std::string href = is_dir ? name + "/" : name;
+	chunk += "\t<li><a href=\"" + href + "\">" + href + "</a></li>\r\n"; //generate HTML href
+}
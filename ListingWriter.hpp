@@ -0,0 +1,49 @@
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Which slice of a directory listing to send. Listings without a page are
+ * streamed in directory order; paginated ones are sorted by name. A page
+ * starts offset names past after, so following next-page links (which carry
+ * the last name shown as after) costs the same however deep they go.
+ */
+struct ListingPage {
+	bool paginated = false;
+	std::string after; // names up to and including this one are skipped
+	size_t offset = 0; // then this many more are skipped
+	size_t limit = 1000;
+};
+
+/**
+ * Generates the HTML listing of a directory a piece at a time, so a caller
+ * can send each piece before the next is read (and, in the coroutine model,
+ * read the directory on a blocking thread while sending from its event loop).
+ *
+ * An unpaginated listing is produced as the directory is read. A paginated
+ * one reads the whole directory on the first call to next, keeping only the
+ * first offset + limit names after page.after in a bounded heap, then hands
+ * out the sorted page.
+ */
+class ListingWriter {
+  public:
+	  ListingWriter(std::string dir_name, ListingPage page, size_t chunk_size);
+
+	  bool next(std::string &chunk);
+
+  private:
+	  void sortPage();
+	  void append(const std::string &name, bool is_dir, std::string &chunk);
+
+	  std::string dir_name;
+	  ListingPage page;
+	  size_t chunk_size;
+	  bool started;
+	  bool finished;
+	  std::filesystem::directory_iterator entries;
+	  std::vector<std::pair<std::string, bool>> sorted; // (name, is_dir)
+	  size_t sorted_pos;
+	  bool more_pages;
+};
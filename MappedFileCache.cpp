@@ -0,0 +1,136 @@
+/**
+ * Implementation of the MappedFile and MappedFileCache classes.
+ * See the associated header file (MappedFileCache.hpp) for the declarations.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MappedFileCache.hpp"
+
+/**
+ * Takes ownership of an existing mapping.
+ *
+ * @param data Start of the mapping.
+ * @param length Number of bytes mapped.
+ * @param inode Inode of the file when it was mapped.
+ * @param mtime Modification time of the file when it was mapped.
+ */
+MappedFile::MappedFile(const char *data, size_t length, ino_t inode,
+		struct timespec mtime)
+	: data(data), length(length), inode(inode), mtime(mtime) {
+}
+
+MappedFile::~MappedFile() {
+	munmap((void *) data, length);
+}
+
+/**
+ * Constructor that sets the size window and the address space budget. The
+ * cache starts out empty.
+ *
+ * @param min_size Smallest file (in bytes) worth mapping.
+ * @param max_size Largest file (in bytes) that will be mapped.
+ * @param budget Total bytes of mappings the cache may hold on to.
+ */
+MappedFileCache::MappedFileCache(size_t min_size, size_t max_size, size_t budget)
+	: min_size(min_size), max_size(max_size), budget(budget), mapped_bytes(0) {
+}
+
+/**
+ * Returns a mapping of the given file, mapping it (or remapping it, if it
+ * changed since it was cached) when needed.
+ *
+ * @param file_name The file to map.
+ * @returns The mapping, or nullptr if the file is outside the size window or
+ * could not be mapped.
+ */
+std::shared_ptr<const MappedFile> MappedFileCache::acquire(const std::string &file_name) {
+	struct stat st;
+	if (stat(file_name.c_str(), &st) < 0 || !S_ISREG(st.st_mode)
+			|| (size_t) st.st_size < min_size || (size_t) st.st_size > max_size) {
+		return nullptr;
+	}
+
+	std::unique_lock<std::mutex> lock(m);
+	auto it = entries.find(file_name);
+	if (it != entries.end()) {
+		const MappedFile &cached = *it->second.file;
+		if (cached.inode == st.st_ino && cached.length == (size_t) st.st_size
+				&& cached.mtime.tv_sec == st.st_mtim.tv_sec
+				&& cached.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			lru.splice(lru.begin(), lru, it->second.lru_position);
+			return it->second.file;
+		}
+		// stale: drop it and map the current contents below
+		mapped_bytes -= cached.length;
+		lru.erase(it->second.lru_position);
+		entries.erase(it);
+	}
+	lock.unlock();
+
+	// Map outside the lock so a slow open doesn't stall every other worker.
+	int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat fd_st;
+	if (fstat(fd, &fd_st) < 0 || fd_st.st_size == 0
+			|| (size_t) fd_st.st_size > max_size) {
+		close(fd);
+		return nullptr;
+	}
+	void *addr = mmap(nullptr, fd_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		return nullptr;
+	}
+	madvise(addr, fd_st.st_size, MADV_WILLNEED);
+	madvise(addr, fd_st.st_size, MADV_SEQUENTIAL);
+
+	auto file = std::make_shared<const MappedFile>((const char *) addr,
+			fd_st.st_size, fd_st.st_ino, fd_st.st_mtim);
+
+	lock.lock();
+	it = entries.find(file_name);
+	if (it != entries.end()) {
+		// another thread mapped it first; use theirs and drop ours
+		lru.splice(lru.begin(), lru, it->second.lru_position);
+		return it->second.file;
+	}
+	lru.push_front(file_name);
+	entries[file_name] = Entry{ file, lru.begin() };
+	mapped_bytes += file->length;
+	evict();
+	return file;
+}
+
+/**
+ * Drops the cached mapping for a file (e.g. after a send from it faulted
+ * because the file was truncated).
+ *
+ * @param file_name The file whose mapping should be dropped.
+ */
+void MappedFileCache::invalidate(const std::string &file_name) {
+	std::lock_guard<std::mutex> lock(m);
+	auto it = entries.find(file_name);
+	if (it != entries.end()) {
+		mapped_bytes -= it->second.file->length;
+		lru.erase(it->second.lru_position);
+		entries.erase(it);
+	}
+}
+
+/**
+ * Evicts least recently used mappings until the cache is within budget.
+ * The caller must hold the lock.
+ */
+void MappedFileCache::evict() {
+	while (mapped_bytes > budget && lru.size() > 1) {
+		auto it = entries.find(lru.back());
+		mapped_bytes -= it->second.file->length;
+		entries.erase(it);
+		lru.pop_back();
+	}
+}
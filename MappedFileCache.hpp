@@ -0,0 +1,61 @@
+#include <cstddef>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+/**
+ * A read-only mapping of a whole file. The mapping is removed (munmap) when
+ * the last shared_ptr to it goes away, so a worker thread that is still
+ * sending from it keeps it alive even after the cache has evicted it.
+ */
+class MappedFile {
+  public:
+	  MappedFile(const char *data, size_t length, ino_t inode, struct timespec mtime);
+	  ~MappedFile();
+
+	  MappedFile(const MappedFile &) = delete;
+	  MappedFile &operator=(const MappedFile &) = delete;
+
+	  const char *data;
+	  size_t length;
+	  ino_t inode;
+	  struct timespec mtime;
+};
+
+/**
+ * Cache of file mappings shared by all of the worker threads.
+ *
+ * Only files between min_size and max_size bytes are mapped; anything else
+ * gets a nullptr back and should be read the usual way. Entries are checked
+ * against the file's inode, size, and mtime on every lookup, so a changed
+ * file is remapped, and the least recently used mappings are evicted once
+ * the cache holds more than budget bytes of address space.
+ */
+class MappedFileCache {
+  public:
+	  MappedFileCache(size_t min_size, size_t max_size, size_t budget);
+
+	  std::shared_ptr<const MappedFile> acquire(const std::string &file_name);
+	  void invalidate(const std::string &file_name);
+
+  private:
+	  struct Entry {
+		  std::shared_ptr<const MappedFile> file;
+		  std::list<std::string>::iterator lru_position;
+	  };
+
+	  void evict();
+
+	  size_t min_size;
+	  size_t max_size;
+	  size_t budget;
+	  size_t mapped_bytes;
+	  std::unordered_map<std::string, Entry> entries;
+	  std::list<std::string> lru; // most recently used at the front
+	  std::mutex m;
+};
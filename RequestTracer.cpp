@@ -0,0 +1,197 @@
+/**
+ * Implementation of the RequestTracer class.
+ * See the associated header file (RequestTracer.hpp) for the declaration of
+ * this class.
+ */
+#include <csignal>
+#include <cstdio>
+
+#include <pthread.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "RequestTracer.hpp"
+
+// Spans kept per thread; older spans are overwritten once this fills up.
+static const size_t EVENTS_PER_THREAD = 16384;
+
+namespace {
+
+struct TraceEvent {
+	const char *name;
+	RequestTracer::clock::time_point start;
+	RequestTracer::clock::time_point end;
+	unsigned long request_id;
+};
+
+/**
+ * A single thread's ring of recorded spans. Only its owning thread writes to
+ * it; the mutex is there so a dump can read it safely.
+ */
+struct ThreadBuffer {
+	int tid;
+	std::vector<TraceEvent> events;
+	size_t next = 0;
+	bool wrapped = false;
+	std::mutex m;
+};
+
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+const RequestTracer::clock::time_point epoch = RequestTracer::clock::now();
+
+thread_local bool current_sampled = false;
+thread_local unsigned long current_request = 0;
+thread_local std::shared_ptr<ThreadBuffer> local_buffer;
+
+/**
+ * Gets (creating and registering on first use) this thread's buffer.
+ */
+ThreadBuffer &threadBuffer() {
+	if (!local_buffer) {
+		local_buffer = std::make_shared<ThreadBuffer>();
+		local_buffer->events.resize(EVENTS_PER_THREAD);
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		local_buffer->tid = registry.size() + 1;
+		registry.push_back(local_buffer);
+	}
+	return *local_buffer;
+}
+
+double micros(RequestTracer::clock::time_point t) {
+	return std::chrono::duration<double, std::micro>(t - epoch).count();
+}
+
+} // namespace
+
+std::atomic<unsigned> RequestTracer::sample_every(0);
+std::atomic<unsigned long> RequestTracer::request_counter(0);
+
+/**
+ * Sets the sampling rate.
+ *
+ * @param every Trace one request out of this many (0 disables tracing).
+ */
+void RequestTracer::configure(unsigned every) {
+	sample_every.store(every, std::memory_order_relaxed);
+}
+
+bool RequestTracer::enabled() {
+	return sample_every.load(std::memory_order_relaxed) != 0;
+}
+
+/**
+ * Starts a new request on this thread and decides whether to sample it.
+ */
+void RequestTracer::beginRequest() {
+	unsigned every = sample_every.load(std::memory_order_relaxed);
+	if (every == 0) {
+		return;
+	}
+	current_request = request_counter.fetch_add(1, std::memory_order_relaxed);
+	current_sampled = (current_request % every == 0);
+}
+
+void RequestTracer::endRequest() {
+	current_sampled = false;
+}
+
+/**
+ * @returns true if the request this thread is handling is being traced.
+ */
+bool RequestTracer::sampled() {
+	return current_sampled;
+}
+
+/**
+ * Records a completed span for the current request.
+ *
+ * @param name Stage name (must be a string literal or otherwise outlive the
+ * tracer).
+ * @param start When the stage started.
+ * @param end When the stage finished.
+ */
+void RequestTracer::record(const char *name, clock::time_point start,
+		clock::time_point end) {
+	if (!current_sampled) {
+		return;
+	}
+	ThreadBuffer &buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.m);
+	buffer.events[buffer.next] = TraceEvent{ name, start, end, current_request };
+	buffer.next++;
+	if (buffer.next == buffer.events.size()) {
+		buffer.next = 0;
+		buffer.wrapped = true;
+	}
+}
+
+/**
+ * Serializes every thread's buffered spans as Chrome trace_event JSON.
+ *
+ * @returns The JSON document.
+ */
+std::string RequestTracer::dumpJSON() {
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		buffers = registry;
+	}
+
+	std::stringstream ss;
+	ss << "{\"traceEvents\":[";
+	bool first = true;
+	char event[256];
+	for (auto &buffer : buffers) {
+		std::lock_guard<std::mutex> lock(buffer->m);
+		size_t count = buffer->wrapped ? buffer->events.size() : buffer->next;
+		size_t start = buffer->wrapped ? buffer->next : 0;
+		for (size_t i = 0; i < count; ++i) {
+			const TraceEvent &e = buffer->events[(start + i) % buffer->events.size()];
+			snprintf(event, sizeof(event),
+					"%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\","
+					"\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"request\":%lu}}",
+					first ? "" : ",", e.name, micros(e.start),
+					micros(e.end) - micros(e.start), buffer->tid, e.request_id);
+			ss << event;
+			first = false;
+		}
+	}
+	ss << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return ss.str();
+}
+
+/**
+ * Starts a background thread that writes a trace dump each time the given
+ * signal arrives. The signal is blocked here so that threads created
+ * afterwards inherit the mask and only the sigwait thread ever receives it;
+ * call this before starting any other threads.
+ *
+ * @param signum The signal to dump on (e.g. SIGUSR1).
+ * @param file_name Where to write the dump.
+ */
+void RequestTracer::dumpOnSignal(int signum, std::string file_name) {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, signum);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+	std::thread dumper([set, file_name]() {
+		while (true) {
+			int sig;
+			if (sigwait(&set, &sig) != 0) {
+				continue;
+			}
+			std::ofstream out(file_name);
+			out << dumpJSON();
+			fprintf(stderr, "Wrote trace to %s\n", file_name.c_str());
+		}
+	});
+	dumper.detach();
+}
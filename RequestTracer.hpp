@@ -0,0 +1,63 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+ * Opt-in, sampled per-request tracing.
+ *
+ * Each worker thread records spans (queue wait, recv, lookup, send) into its
+ * own fixed-size ring buffer. The buffers can be dumped as Chrome trace_event
+ * JSON (load it in chrome://tracing or Perfetto). When tracing is off, the
+ * only per-request cost is one relaxed atomic load.
+ */
+class RequestTracer {
+  public:
+	  using clock = std::chrono::steady_clock;
+
+	  // Trace one request out of every sample_every (0 turns tracing off).
+	  static void configure(unsigned sample_every);
+	  static bool enabled();
+
+	  // Bracket each request; spans are only kept for sampled requests.
+	  static void beginRequest();
+	  static void endRequest();
+	  static bool sampled();
+
+	  static void record(const char *name, clock::time_point start,
+			  clock::time_point end);
+	  static std::string dumpJSON();
+
+	  // Write dumpJSON() to file_name whenever signum arrives.
+	  static void dumpOnSignal(int signum, std::string file_name);
+
+  private:
+	  static std::atomic<unsigned> sample_every;
+	  static std::atomic<unsigned long> request_counter;
+};
+
+/**
+ * Records a span covering its own lifetime, if the current request is being
+ * sampled.
+ */
+class TraceSpan {
+  public:
+	  explicit TraceSpan(const char *name)
+		  : name(name), active(RequestTracer::sampled()) {
+		  if (active) {
+			  start = RequestTracer::clock::now();
+		  }
+	  }
+	  ~TraceSpan() {
+		  if (active) {
+			  RequestTracer::record(name, start, RequestTracer::clock::now());
+		  }
+	  }
+
+	  TraceSpan(const TraceSpan &) = delete;
+	  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  private:
+	  const char *name;
+	  bool active;
+	  RequestTracer::clock::time_point start;
+};
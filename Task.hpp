@@ -0,0 +1,106 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/**
+ * A lazily started coroutine returning T, for use with co_await.
+ *
+ * The coroutine doesn't run until it is awaited, and when it finishes it
+ * resumes whoever awaited it directly (symmetric transfer), so chains of
+ * nested Tasks neither grow the stack nor touch the scheduler. Exceptions
+ * thrown inside propagate out of the co_await.
+ */
+template <typename T = void>
+class Task;
+
+namespace task_detail {
+
+struct PromiseBase {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+			std::coroutine_handle<> next = h.promise().continuation;
+			return next ? next : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+	std::optional<T> value;
+	Task<T> get_return_object();
+	void return_value(T v) { value = std::move(v); }
+	T result() {
+		if (exception) std::rethrow_exception(exception);
+		return std::move(*value);
+	}
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+	Task<void> get_return_object();
+	void return_void() {}
+	void result() {
+		if (exception) std::rethrow_exception(exception);
+	}
+};
+
+} // namespace task_detail
+
+template <typename T>
+class Task {
+  public:
+	  using promise_type = task_detail::Promise<T>;
+	  using handle_type = std::coroutine_handle<promise_type>;
+
+	  explicit Task(handle_type h) : h(h) {}
+	  Task(Task &&other) noexcept : h(std::exchange(other.h, nullptr)) {}
+	  Task &operator=(Task &&other) noexcept {
+		  if (this != &other) {
+			  if (h) h.destroy();
+			  h = std::exchange(other.h, nullptr);
+		  }
+		  return *this;
+	  }
+	  Task(const Task &) = delete;
+	  Task &operator=(const Task &) = delete;
+	  ~Task() {
+		  if (h) h.destroy();
+	  }
+
+	  bool await_ready() const noexcept { return false; }
+	  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+		  h.promise().continuation = caller;
+		  return h;
+	  }
+	  T await_resume() { return h.promise().result(); }
+
+  private:
+	  handle_type h;
+};
+
+namespace task_detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+	return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+	return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace task_detail
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Usage: bench-models.sh [PORT_NUM] [ROOT_DIR] [CONNECTIONS]
+#
+# Compares the worker-thread model (the default) with the coroutine model
+# (TORERO_MODEL=coro):
+#   - memory: server RSS/virtual size before and while CONNECTIONS idle
+#     connections are held open, each an in-flight request waiting on recv
+#   - throughput: 64 clients fetching /index.html for 5 seconds
+# Run from this directory after building ../torero-serve and ./load-bench.
+#
+# Note that the thread model only takes NUM_THREADS connections off the
+# queue at a time; the rest wait in the BoundedBuffer and the kernel's accept
+# backlog (and may fail to connect at all), which is exactly the limit the
+# coroutine model removes.
+
+port_num=$1
+root_dir=$2
+connections=${3:-2000}
+
+if [ "$#" -lt 2 ]; then
+	echo "Usage: bench-models.sh [PORT_NUM] [ROOT_DIR] [CONNECTIONS]"
+	exit
+fi
+
+ulimit -n $((connections + 1024)) 2>/dev/null
+
+# prints "rss_kb vm_kb" for a pid
+memory() {
+	awk '/^VmRSS/ { rss = $2 } /^VmSize/ { vm = $2 } END { print rss, vm }' /proc/$1/status
+}
+
+for model in threads coro; do
+	echo "== $model model"
+	TORERO_MODEL=$model ../torero-serve $port_num $root_dir > /dev/null &
+	server_pid=$!
+	sleep 1
+
+	read rss_before vm_before <<< "$(memory $server_pid)"
+	held_file=$(mktemp)
+	./load-bench hold localhost $port_num $connections 6 > $held_file &
+	hold_pid=$!
+	sleep 4
+	read rss_during vm_during <<< "$(memory $server_pid)"
+	wait $hold_pid
+	held=$(awk '{ print $2 }' $held_file)
+	rm -f $held_file
+
+	echo "RSS: $rss_before KB idle, $rss_during KB holding $held of $connections connections" \
+		"($(( (rss_during - rss_before) * 1024 / (held > 0 ? held : 1) )) bytes/connection)"
+	echo "VM:  $vm_before KB idle, $vm_during KB holding $held connections"
+
+	sleep 1
+	echo -n "Throughput: "
+	./load-bench rate localhost $port_num /index.html 64 5
+
+	kill $server_pid
+	wait $server_pid 2>/dev/null
+	sleep 1
+done
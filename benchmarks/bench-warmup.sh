@@ -0,0 +1,100 @@
+#!/bin/bash
+
+# Usage: bench-warmup.sh [PORT_NUM] [FILES] [FILE_KB]
+#
+# Compares how quickly the server reaches its steady-state p99 after a
+# restart with a cold page cache, with and without startup warm-up
+# (TORERO_WARMUP_FILE):
+#   1. builds a site of FILES random files of FILE_KB each, and runs the
+#      server against it long enough to save a hot-file manifest
+#   2. for each mode, evicts the site from the page cache, starts the server,
+#      and runs 16 clients requesting random files, reporting p99 every
+#      250 ms
+# Time to steady state is measured from starting the server (so it includes
+# the warm-up itself) to the first interval after which p99 stays within
+# twice the steady-state p99 (the median p99 of the second half of the run).
+# Run from this directory after building ../torero-serve and ./load-bench.
+
+port_num=$1
+num_files=${2:-400}
+file_kb=${3:-256}
+
+if [ "$#" -lt 1 ]; then
+	echo "Usage: bench-warmup.sh [PORT_NUM] [FILES] [FILE_KB]"
+	exit
+fi
+
+site=$(mktemp -d)
+trap 'rm -rf $site' EXIT
+
+echo "Creating $num_files files of $file_kb KB in $site"
+for i in $(seq 0 $((num_files - 1))); do
+	dir=d$((i % 20))
+	mkdir -p $site/$dir
+	dd if=/dev/urandom of=$site/$dir/f$i.bin bs=1K count=$file_kb status=none
+	echo "/$dir/f$i.bin" >> $site/paths.txt
+done
+sync
+
+# waits for the server to accept connections
+wait_for_server() {
+	until (exec 3<>/dev/tcp/localhost/$port_num) 2>/dev/null; do
+		sleep 0.01
+	done
+}
+
+# drops the site's files from the page cache
+evict() {
+	find $site -name '*.bin' -exec dd if={} iflag=nocache count=0 status=none \;
+}
+
+echo "Recording a manifest"
+TORERO_WARMUP_FILE=$site/manifest TORERO_WARMUP_TOP=$num_files TORERO_WARMUP_INTERVAL=1 \
+	../torero-serve $port_num $site > /dev/null &
+server_pid=$!
+wait_for_server
+./load-bench ramp localhost $port_num $site/paths.txt 16 3 1000 > /dev/null
+sleep 2
+kill $server_pid
+wait $server_pid 2>/dev/null
+echo "$(wc -l < $site/manifest) paths in manifest"
+
+for mode in cold warm; do
+	echo "== $mode start"
+	evict
+	sleep 1
+
+	start_ms=$(date +%s%3N)
+	if [ $mode = warm ]; then
+		TORERO_WARMUP_FILE=$site/manifest TORERO_WARMUP_TOP=$num_files \
+			TORERO_WARMUP_INTERVAL=3600 ../torero-serve $port_num $site &
+	else
+		../torero-serve $port_num $site > /dev/null &
+	fi
+	server_pid=$!
+	wait_for_server
+	listen_ms=$(( $(date +%s%3N) - start_ms ))
+
+	./load-bench ramp localhost $port_num $site/paths.txt 16 8 250 > $site/ramp.txt
+	kill $server_pid
+	wait $server_pid 2>/dev/null
+
+	awk -v listen_ms=$listen_ms '
+		BEGIN { n = 0 }
+		/^interval/ { ms[n] = $4; p99[n] = $8 + 0; n++ }
+		END {
+			# steady state: median p99 of the second half
+			m = 0
+			for (i = int(n / 2); i < n; i++) {
+				for (j = m++; j > 0 && tail[j - 1] > p99[i]; j--) tail[j] = tail[j - 1]
+				tail[j] = p99[i]
+			}
+			steady = tail[int(m / 2)]
+			settled = n - 1
+			for (i = n - 1; i >= 0 && p99[i] <= 2 * steady; i--) settled = i
+			printf "listening after %d ms; first interval p99 %dus; steady p99 %dus\n",
+				listen_ms, p99[0], steady
+			printf "time to steady state: %d ms\n", listen_ms + ms[settled]
+		}' $site/ramp.txt
+	sleep 1
+done
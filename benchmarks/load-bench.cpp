@@ -0,0 +1,310 @@
+/*
+ * load-bench: a small load generator for comparing ToreroServe's models.
+ *
+ * Modes:
+ *   load-bench hold (host) (port) (connections) (seconds)
+ *       Opens the given number of connections, sends nothing on them (so
+ *       each one stays an in-flight request waiting on recv), and holds them
+ *       open for the given time. Prints how many connected.
+ *   load-bench rate (host) (port) (path) (clients) (seconds)
+ *       Runs the given number of clients, each sending "GET (path)" requests
+ *       back to back for the given time. Prints throughput and latency
+ *       percentiles.
+ *   load-bench ramp (host) (port) (path list) (clients) (seconds) (interval ms)
+ *       Like rate, but each request is for a random path from the given file
+ *       (one path per line), and the p99 is printed for every interval, to
+ *       show how long the server takes to reach its steady state.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::string;
+using std::vector;
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Connects to the server, giving up after timeout_ms.
+ *
+ * @param addr The server's address.
+ * @param timeout_ms How long to wait for the connection.
+ * @returns The connected socket, or -1 on failure.
+ */
+int connectTo(const struct sockaddr_in &addr, int timeout_ms) {
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	int flags = fcntl(sock, F_GETFL);
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	int ret = connect(sock, (const struct sockaddr *) &addr, sizeof(addr));
+	if (ret < 0 && errno == EINPROGRESS) {
+		struct pollfd pfd = { sock, POLLOUT, 0 };
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if (poll(&pfd, 1, timeout_ms) == 1
+				&& getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+			ret = 0;
+		}
+	}
+	if (ret < 0) {
+		close(sock);
+		return -1;
+	}
+	fcntl(sock, F_SETFL, flags);
+	return sock;
+}
+
+/**
+ * Opens connections and holds them open without sending a request. All the
+ * connects are started at once; any not established within two seconds
+ * (e.g. because the server's accept backlog is full) are given up on.
+ */
+void hold(const struct sockaddr_in &addr, int connections, int seconds) {
+	vector<struct pollfd> pending;
+	for (int i = 0; i < connections; ++i) {
+		int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (sock < 0) {
+			break;
+		}
+		int ret = connect(sock, (const struct sockaddr *) &addr, sizeof(addr));
+		if (ret < 0 && errno != EINPROGRESS) {
+			close(sock);
+			continue;
+		}
+		pending.push_back({ sock, POLLOUT, 0 });
+	}
+
+	vector<int> socks;
+	auto deadline = clock_type::now() + std::chrono::seconds(2);
+	while (!pending.empty() && clock_type::now() < deadline) {
+		if (poll(pending.data(), pending.size(), 100) <= 0) {
+			continue;
+		}
+		vector<struct pollfd> still_pending;
+		for (auto &pfd : pending) {
+			if (pfd.revents == 0) {
+				still_pending.push_back(pfd);
+				continue;
+			}
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err == 0) {
+				socks.push_back(pfd.fd);
+			}
+			else {
+				close(pfd.fd);
+			}
+		}
+		pending.swap(still_pending);
+	}
+	for (auto &pfd : pending) {
+		close(pfd.fd);
+	}
+
+	cout << "held " << socks.size() << " of " << connections << " connections\n";
+	cout.flush();
+	std::this_thread::sleep_for(std::chrono::seconds(seconds));
+	for (int sock : socks) {
+		close(sock);
+	}
+}
+
+/**
+ * Sends one request and reads the response until the server closes.
+ *
+ * @returns true if a response was received.
+ */
+bool fetch(const struct sockaddr_in &addr, const string &request) {
+	int sock = connectTo(addr, 5000);
+	if (sock < 0) {
+		return false;
+	}
+	size_t sent = 0;
+	while (sent < request.size()) {
+		ssize_t n = send(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) {
+			close(sock);
+			return false;
+		}
+		sent += n;
+	}
+	char buf[65536];
+	size_t total = 0;
+	ssize_t n;
+	while ((n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+		total += n;
+	}
+	close(sock);
+	return total > 0;
+}
+
+/**
+ * Runs clients sending requests back to back, then reports throughput and
+ * latency.
+ */
+void rate(const struct sockaddr_in &addr, const string &path, int clients, int seconds) {
+	string request = "GET " + path + " HTTP/1.0\r\nHost: bench\r\n\r\n";
+	auto deadline = clock_type::now() + std::chrono::seconds(seconds);
+	std::mutex m;
+	vector<double> latencies_us;
+	std::atomic<long> errors(0);
+
+	vector<std::thread> threads;
+	for (int i = 0; i < clients; ++i) {
+		threads.emplace_back([&]() {
+			vector<double> mine;
+			while (clock_type::now() < deadline) {
+				auto start = clock_type::now();
+				if (!fetch(addr, request)) {
+					errors++;
+					continue;
+				}
+				mine.push_back(std::chrono::duration<double, std::micro>(
+							clock_type::now() - start).count());
+			}
+			std::lock_guard<std::mutex> lock(m);
+			latencies_us.insert(latencies_us.end(), mine.begin(), mine.end());
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	std::sort(latencies_us.begin(), latencies_us.end());
+	auto pct = [&](double p) {
+		if (latencies_us.empty()) return 0.0;
+		return latencies_us[std::min(latencies_us.size() - 1,
+				(size_t) (p * latencies_us.size()))];
+	};
+	printf("requests %zu errors %ld req/s %.0f p50 %.0fus p99 %.0fus max %.0fus\n",
+			latencies_us.size(), errors.load(),
+			latencies_us.size() / (double) seconds, pct(0.50), pct(0.99),
+			latencies_us.empty() ? 0.0 : latencies_us.back());
+}
+
+/**
+ * Runs clients requesting random paths from a list back to back, then
+ * reports the request count and p99 latency of each interval (by when the
+ * request finished).
+ */
+void ramp(const struct sockaddr_in &addr, const string &path_list, int clients,
+		int seconds, int interval_ms) {
+	vector<string> requests;
+	std::ifstream in(path_list);
+	string path;
+	while (getline(in, path)) {
+		if (!path.empty()) {
+			requests.push_back("GET " + path + " HTTP/1.0\r\nHost: bench\r\n\r\n");
+		}
+	}
+	if (requests.empty()) {
+		cout << "No paths in " << path_list << "\n";
+		exit(1);
+	}
+
+	auto begin = clock_type::now();
+	auto deadline = begin + std::chrono::seconds(seconds);
+	size_t num_intervals = (seconds * 1000 + interval_ms - 1) / interval_ms;
+	std::mutex m;
+	vector<vector<double>> latencies_us(num_intervals);
+	std::atomic<long> errors(0);
+
+	vector<std::thread> threads;
+	for (int i = 0; i < clients; ++i) {
+		threads.emplace_back([&, i]() {
+			std::mt19937 rng(i);
+			std::uniform_int_distribution<size_t> pick(0, requests.size() - 1);
+			vector<std::pair<size_t, double>> mine;
+			while (clock_type::now() < deadline) {
+				auto start = clock_type::now();
+				if (!fetch(addr, requests[pick(rng)])) {
+					errors++;
+					continue;
+				}
+				auto end = clock_type::now();
+				size_t interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+						end - begin).count() / interval_ms;
+				mine.emplace_back(std::min(interval, num_intervals - 1),
+						std::chrono::duration<double, std::micro>(end - start).count());
+			}
+			std::lock_guard<std::mutex> lock(m);
+			for (auto &sample : mine) {
+				latencies_us[sample.first].push_back(sample.second);
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	for (size_t i = 0; i < num_intervals; ++i) {
+		vector<double> &interval = latencies_us[i];
+		std::sort(interval.begin(), interval.end());
+		double p99 = interval.empty() ? 0.0 : interval[std::min(interval.size() - 1,
+				(size_t) (0.99 * interval.size()))];
+		printf("interval %zu ms %zu requests %zu p99 %.0fus\n",
+				i, i * interval_ms, interval.size(), p99);
+	}
+	printf("errors %ld\n", errors.load());
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		cout << "Usage: " << argv[0] << " hold (host) (port) (connections) (seconds)\n"
+			<< "       " << argv[0] << " rate (host) (port) (path) (clients) (seconds)\n"
+			<< "       " << argv[0] << " ramp (host) (port) (path list) (clients) (seconds) (interval ms)\n";
+		exit(1);
+	}
+	string mode = argv[1];
+	if ((mode == "hold" && argc != 6) || (mode == "rate" && argc != 7)
+			|| (mode == "ramp" && argc != 8)
+			|| (mode != "hold" && mode != "rate" && mode != "ramp")) {
+		cout << "INCORRECT USAGE! Run with no arguments for usage.\n";
+		exit(1);
+	}
+
+	struct addrinfo hints = {}, *res;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(argv[2], argv[3], &hints, &res) != 0) {
+		cout << "Could not resolve " << argv[2] << "\n";
+		exit(1);
+	}
+	struct sockaddr_in addr = *(struct sockaddr_in *) res->ai_addr;
+	freeaddrinfo(res);
+
+	if (mode == "hold") {
+		hold(addr, std::stoi(argv[4]), std::stoi(argv[5]));
+	}
+	else if (mode == "rate") {
+		rate(addr, argv[4], std::stoi(argv[5]), std::stoi(argv[6]));
+	}
+	else {
+		ramp(addr, argv[4], std::stoi(argv[5]), std::stoi(argv[6]), std::stoi(argv[7]));
+	}
+	return 0;
+}
@@ -0,0 +1,292 @@
+/**
+ * bundle-gen: packs a static site directory into a C++ source file that can
+ * be linked into torero-serve (see the torero-serve-bundle make target).
+ *
+ * This program takes two arguments:
+ * 	1. The directory to pack (e.g. WWW)
+ * 	2. The C++ file to generate (e.g. asset-bundle.cpp)
+ *
+ * For every file (and every directory, as its index.html or a generated
+ * listing) it emits the body as a byte array, a gzip variant when that is
+ * smaller, a precomputed MIME type and ETag, and prebuilt response headers.
+ * The assets are written out sorted by path so findAsset can binary search.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using std::string;
+using std::vector;
+
+struct BundleEntry {
+	string path;
+	string mime_type;
+	string body;
+};
+
+/**
+ * Picks a Content-Type the same way torero-serve's sendHeader does.
+ *
+ * @param file The file being packed.
+ * @returns The MIME type for the file's extension.
+ */
+string mimeType(const fs::path &file) {
+	string ext = file.extension().string();
+	if (ext == ".html") return "text/html";
+	if (ext == ".css") return "text/css";
+	if (ext == ".jpg") return "image/jpeg";
+	if (ext == ".gif") return "image/gif";
+	if (ext == ".png") return "image/png";
+	if (ext == ".pdf") return "application/pdf";
+	return "text/plain";
+}
+
+/**
+ * Reads a whole file into a string.
+ *
+ * @param file The file to read.
+ * @returns The file's contents.
+ */
+string readFile(const fs::path &file) {
+	std::ifstream in(file, std::ios::binary);
+	std::stringstream ss;
+	ss << in.rdbuf();
+	return ss.str();
+}
+
+/**
+ * Builds the same directory listing page sendHTML generates at runtime.
+ *
+ * @param dir The directory to list.
+ * @returns The listing page.
+ */
+string listingPage(const fs::path &dir) {
+	vector<string> items;
+	for (auto &entry : fs::directory_iterator(dir)) {
+		string name = entry.path().filename().string();
+		if (entry.is_regular_file()) {
+			items.push_back("\t<li><a href=\"" + name + "\">" + name + "</a></li>\r\n");
+		}
+		else if (entry.is_directory()) {
+			items.push_back("\t<li><a href=\"" + name + "/\">" + name + "/</a></li>\r\n");
+		}
+	}
+	std::sort(items.begin(), items.end());
+
+	std::stringstream ss;
+	ss  << "<html>" << "\r\n"
+		<< "<head>" << "<title></title>" << "</head>" << "\r\n"
+		<< "<body>" << "\r\n"
+		<< "<ul>" << "\r\n";
+	for (auto &item : items) {
+		ss << item;
+	}
+	ss  << "</ul>" << "\r\n"
+		<< "</body>" << "\r\n"
+		<< "</html>" << "\r\n";
+	return ss.str();
+}
+
+/**
+ * Gzips a buffer (RFC 1952 framing so it can go out as Content-Encoding: gzip).
+ *
+ * @param data The bytes to compress.
+ * @returns The compressed bytes, or an empty string on failure.
+ */
+string gzip(const string &data) {
+	z_stream zs{};
+	// 15 window bits + 16 selects the gzip wrapper instead of zlib's.
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+				Z_DEFAULT_STRATEGY) != Z_OK) {
+		return "";
+	}
+	string out(deflateBound(&zs, data.size()), '\0');
+	zs.next_in = (Bytef *) data.data();
+	zs.avail_in = data.size();
+	zs.next_out = (Bytef *) &out[0];
+	zs.avail_out = out.size();
+	int ret = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return (ret == Z_STREAM_END) ? out : "";
+}
+
+/**
+ * FNV-1a hash of the body, used as a strong ETag.
+ *
+ * @param data The body to hash.
+ * @returns The quoted ETag value.
+ */
+string etag(const string &data) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : data) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	char buf[24];
+	snprintf(buf, sizeof(buf), "\"%016llx\"", (unsigned long long) hash);
+	return buf;
+}
+
+/**
+ * Escapes a string so it can be emitted as a C++ string literal.
+ *
+ * @param s The string to escape.
+ * @returns The quoted literal.
+ */
+string literal(const string &s) {
+	std::stringstream ss;
+	ss << '"';
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\') ss << '\\' << c;
+		else if (c == '\r') ss << "\\r";
+		else if (c == '\n') ss << "\\n";
+		else ss << c;
+	}
+	ss << '"';
+	return ss.str();
+}
+
+/**
+ * Writes a byte array definition to the generated file.
+ *
+ * @param out The generated source.
+ * @param name The array's identifier.
+ * @param data The bytes to emit.
+ */
+void writeArray(std::ostream &out, const string &name, const string &data) {
+	out << "alignas(64) static const unsigned char " << name << "["
+		<< std::max<size_t>(data.size(), 1) << "] = {";
+	for (size_t i = 0; i < data.size(); ++i) {
+		if (i % 16 == 0) out << "\n\t";
+		char buf[8];
+		snprintf(buf, sizeof(buf), "0x%02x,", (unsigned char) data[i]);
+		out << buf;
+	}
+	out << "\n};\n";
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cout << "INCORRECT USAGE!\n";
+		std::cout << "Format: './bundle-gen (root dir) (output .cpp)'\n";
+		exit(1);
+	}
+
+	fs::path root(argv[1]);
+	if (!fs::is_directory(root)) {
+		std::cerr << root << " is not a directory\n";
+		exit(1);
+	}
+
+	vector<BundleEntry> entries;
+
+	// The root itself, then everything below it.
+	vector<fs::path> dirs = { root };
+	for (auto &entry : fs::recursive_directory_iterator(root)) {
+		string rel = "/" + fs::relative(entry.path(), root).generic_string();
+		if (entry.is_regular_file()) {
+			entries.push_back({ rel, mimeType(entry.path()), readFile(entry.path()) });
+		}
+		else if (entry.is_directory()) {
+			dirs.push_back(entry.path());
+		}
+	}
+	for (auto &dir : dirs) {
+		string rel = fs::relative(dir, root).generic_string();
+		string path = (rel == ".") ? "/" : "/" + rel + "/";
+		fs::path index = dir / "index.html";
+		if (fs::is_regular_file(index)) {
+			entries.push_back({ path, "text/html", readFile(index) });
+		}
+		else {
+			entries.push_back({ path, "text/html", listingPage(dir) });
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(),
+			[](const BundleEntry &a, const BundleEntry &b) { return a.path < b.path; });
+
+	std::ofstream out(argv[2]);
+	out << "// Generated by bundle-gen from " << root.generic_string()
+		<< ". Do not edit.\n"
+		<< "#include \"AssetBundle.hpp\"\n\n";
+
+	vector<string> index_rows;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		const BundleEntry &e = entries[i];
+		string tag = etag(e.body);
+		string body_name = "asset_" + std::to_string(i);
+		writeArray(out, body_name, e.body);
+
+		std::stringstream header;
+		header << "HTTP/1.0 200 OK\r\n"
+			<< "Content-Type: " << e.mime_type << "\r\n"
+			<< "Content-Length: " << e.body.size() << "\r\n"
+			<< "ETag: " << tag << "\r\n"
+			<< "Vary: Accept-Encoding\r\n"
+			<< "\r\n";
+
+		std::stringstream not_modified;
+		not_modified << "HTTP/1.0 304 NOT MODIFIED\r\n"
+			<< "ETag: " << tag << "\r\n"
+			<< "\r\n";
+
+		// Only keep the gzip variant when it actually saves bytes.
+		string gz = gzip(e.body);
+		string gz_header = "nullptr", gz_header_len = "0";
+		string gz_body = "nullptr", gz_body_len = "0";
+		if (!gz.empty() && gz.size() < e.body.size()) {
+			gz_body = body_name + "_gz";
+			writeArray(out, gz_body, gz);
+			std::stringstream gh;
+			gh << "HTTP/1.0 200 OK\r\n"
+				<< "Content-Type: " << e.mime_type << "\r\n"
+				<< "Content-Encoding: gzip\r\n"
+				<< "Content-Length: " << gz.size() << "\r\n"
+				<< "ETag: " << tag << "\r\n"
+				<< "Vary: Accept-Encoding\r\n"
+				<< "\r\n";
+			gz_header = literal(gh.str());
+			gz_header_len = std::to_string(gh.str().size());
+			gz_body_len = std::to_string(gz.size());
+		}
+
+		std::stringstream row;
+		row << "\t{ " << literal(e.path) << ", " << literal(e.mime_type) << ", "
+			<< literal(tag) << ",\n\t  "
+			<< literal(header.str()) << ", " << header.str().size() << ",\n\t  "
+			<< body_name << ", " << e.body.size() << ",\n\t  "
+			<< gz_header << ", " << gz_header_len << ",\n\t  "
+			<< gz_body << ", " << gz_body_len << ",\n\t  "
+			<< literal(not_modified.str()) << ", " << not_modified.str().size()
+			<< " },\n";
+		index_rows.push_back(row.str());
+	}
+
+	out << "\nconst Asset bundle_assets[] = {\n";
+	for (auto &row : index_rows) {
+		out << row;
+	}
+	out << "};\n\n"
+		<< "const size_t bundle_asset_count = " << entries.size() << ";\n";
+
+	if (!out) {
+		std::cerr << "Error writing " << argv[2] << "\n";
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Usage: test-h2.sh [HOSTNAME] [PORT_NUM]
+# The server must be serving the WWW directory. Requires curl built with
+# HTTP/2 support (curl -V lists "HTTP2").
+
+server_hostname=$1
+port_num=$2
+
+if [ "$#" -ne 2 ]; then
+	echo "Usage: test-h2.sh [HOSTNAME] [PORT_NUM]"
+	exit
+fi
+
+base=http://$server_hostname:$port_num
+assets="pic.html styled.html comp375.css tux.png monorail.jpg usd-logo.gif test/dir/endtoend.pdf"
+mkdir -p h2-output
+failed=0
+
+# Prior knowledge: open with the HTTP/2 preface straight away.
+echo "Fetching index.html over h2c with prior knowledge"
+version=$(curl -s --http2-prior-knowledge -o h2-output/index.html -w "%{http_version}" $base/index.html)
+if [ "$version" != "2" ] || ! cmp --silent ../WWW/index.html h2-output/index.html; then
+	echo "Prior knowledge fetch failed (HTTP version $version)"
+	failed=1
+fi
+
+# Upgrade: start as HTTP/1.1 and switch to h2c, then multiplex the rest of
+# the page's assets as parallel streams on that one connection.
+echo "Fetching page assets in parallel over one upgraded h2c connection"
+urls=""
+outputs=""
+for asset in $assets; do
+	urls="$urls $base/$asset"
+	outputs="$outputs -o h2-output/$(basename $asset)"
+done
+connects=$(curl -s --http2 --parallel --no-progress-meter $outputs -w "%{num_connects}\n" $urls \
+	| awk '{ total += $1 } END { print total }')
+if [ "$connects" != "1" ]; then
+	echo "Expected 1 connection for all assets, curl made $connects"
+	failed=1
+fi
+for asset in $assets; do
+	if ! cmp --silent ../WWW/$asset h2-output/$(basename $asset); then
+		echo "$asset differs from ../WWW/$asset"
+		failed=1
+	fi
+done
+
+if [ $failed -eq 0 ]; then
+	echo "HTTP/2 test passed!"
+else
+	echo "HTTP/2 test failed! Check the contents of h2-output/."
+fi
@@ -11,22 +11,29 @@
  */
 
 // standard C libraries
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <csignal>
 
 // operating system specific libraries
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <strings.h>
 #include <unistd.h>
 #include <pthread.h>
 
 // C++ standard libraries
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <thread>
 #include <string>
@@ -35,8 +42,21 @@
 #include <regex>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
 
 #include "BoundedBuffer.hpp"
+#include "ClientLimiter.hpp"
+#include "HotFileManifest.hpp"
+#include "MappedFileCache.hpp"
+#include "RequestTracer.hpp"
+#include "Http2Connection.hpp"
+#include "ListingWriter.hpp"
+#include "CoroScheduler.hpp"
+#ifdef EMBEDDED_BUNDLE
+#include "AssetBundle.hpp"
+#endif
 
 #define BUFFER_SIZE 2048
 #define TRANSACTION_CLOSE 2 //size of \r\n
@@ -52,18 +72,85 @@ using std::thread;
 
 // This will limit how many clients can be waiting for a connection.
 static const int BACKLOG = 10;
-const size_t BUFFER_CAPACITY = 10;
+// Room for connections to wait while the BoundedBuffer picks which client to
+// serve next (deficit-round-robin by source address).
+const size_t BUFFER_CAPACITY = 64;
 const size_t NUM_THREADS = 8;
+// HTTP/2 connections are long-lived and each holds a worker thread, so only
+// this many are served at once, leaving the rest of the workers to HTTP/1.0.
+const size_t MAX_HTTP2_CONNECTIONS = NUM_THREADS / 2;
+// Coroutine model (TORERO_MODEL=coro): threads for open/stat and reading
+// directories, and a separate pool, one thread per connection, for HTTP/2.
+const size_t NUM_BLOCKING_THREADS = 16;
+const size_t NUM_HTTP2_THREADS = 64;
+
+// Files in this size window are sent from a shared mmap cache instead of
+// being read through an ifstream on every request.
+const size_t MMAP_MIN_SIZE = 64 * 1024;
+const size_t MMAP_MAX_SIZE = 256 * 1024 * 1024;
+const size_t MMAP_BUDGET = 1024 * 1024 * 1024;
+static MappedFileCache mapped_files(MMAP_MIN_SIZE, MMAP_MAX_SIZE, MMAP_BUDGET);
+
+// Per-client limits, all off unless set in the environment (see main):
+// open connections and request rate per source address, and the byte rate
+// each connection's file bodies are sent at.
+static std::unique_ptr<ClientLimiter> client_limits;
+static uint64_t client_send_rate = 0;
+
+// Hits per path, saved periodically and prefetched on startup when
+// TORERO_WARMUP_FILE is set (see main).
+static HotFileManifest hot_files;
+static bool record_hits = false;
+
+// Bytes this thread has sent, so consume can charge clients for their work.
+static thread_local uint64_t bytes_sent_by_thread = 0;
+
+// Directory listings are streamed out in pieces of roughly this size.
+const size_t LISTING_FLUSH_SIZE = 16 * 1024;
+// Paginated listings hold at most offset + limit names while sorting.
+const size_t MAX_LISTING_WINDOW = 100000;
+
+/**
+ * A claim on one of the HTTP/2 connection slots, held while a connection is
+ * served. acquired is false if they were all in use.
+ */
+struct Http2Slot {
+    static inline std::atomic<size_t> in_use{ 0 };
+    static inline size_t limit = MAX_HTTP2_CONNECTIONS;
+    bool acquired;
+
+    Http2Slot() : acquired(++in_use <= limit) {
+        if (!acquired) {
+            --in_use;
+        }
+    }
+    ~Http2Slot() {
+        if (acquired) {
+            --in_use;
+        }
+    }
+};
 
 // forward declarations
 int createSocketAndListen(const int port_num);
 void acceptConnections(const int server_sock, std::string root);
-void handleClient(const int client_sock);
+void acceptConnectionsAsync(const int server_sock, std::string root);
+void handleClient(const int client_sock, std::string root, uint32_t client);
+Task<void> handleClientAsync(const int client_sock, std::string root, uint32_t client);
+bool admitClient(const int client_sock, uint32_t client);
+double envNumber(const char *name, double default_value);
 void sendData(int socked_fd, const char *data, size_t data_length);
+void sendShaped(int socked_fd, const char *data, size_t data_length,
+        SendShaper &shaper);
 int receiveData(int socked_fd, char *dest, size_t buff_size);
 void consume (BoundedBuffer &buffer, std::string root);
 
 bool validGET(std::string request);
+void parseRequestLine(const std::string &request, std::string &file_name,
+        std::string &version);
+std::string splitQuery(std::string &file_name);
+bool parseListingPage(const std::string &query, ListingPage &page);
+bool percentDecode(const std::string &value, std::string &decoded);
 bool fileExists(std::string file_name);
 bool isDirectory(std::string file_name);
 
@@ -71,32 +158,133 @@ void sendBad(const int client_sock);
 void sendNotFound(const int client_sock);
 void sendOK(const int client_sock);
 
-void sendHeader(const int client_sock, std::string file_name);
-void sendHTML(const int client_sock, std::string file_name);
-void sendFile(const int client_sock, std::string file_name);
+bool contentType(const std::string &file_name, std::string &file_type);
+void sendHeader(const int client_sock, std::string file_name, uint64_t content_length);
+void sendHTML(const int client_sock, std::string file_name, const ListingPage &page);
+void writeListing(const std::string &dir_name, const ListingPage &page,
+        const std::function<void(const std::string &)> &emit);
+void sendFile(const int client_sock, std::string file_name, SendShaper &shaper);
 void sendError(const int client_sock);
+void sendTrace(const int client_sock);
+std::string traceResponse();
+std::string notFoundResponse();
+
+std::string headerValue(const std::string &request, const std::string &name);
+std::string errorPage();
+Http2Response resolveHttp2(std::string root, const std::string &method,
+        const std::string &path);
+bool wantsHttp2(const std::string &request);
+void serveHttp2(const int client_sock, std::string root, const std::string &request,
+        uint32_t client);
+#ifdef EMBEDDED_BUNDLE
+void sendBundled(const int client_sock, const std::string &request,
+		const std::string &file_name);
+bool bundledResponse(const std::string &request, const std::string &file_name,
+		const char *&header, size_t &header_length,
+		const char *&body, size_t &body_length);
+#endif
 
 int main(int argc, char** argv) {
 
 	/* Make sure the user called our program correctly. */
+#ifdef EMBEDDED_BUNDLE
+	// The site is compiled in, so the root directory is optional (and unused).
+	if (argc != 2 && argc != 3) {
+		cout << "INCORRECT USAGE!\n";
+        cout << "Format: './(compiled exec) (port num)'\n";
+		exit(1);
+	}
+#else
 	if (argc != 3) {
 		cout << "INCORRECT USAGE!\n";
         cout << "Format: './(compiled exec) (port num) (root dir)'\n";
 		exit(1);
 	}
+#endif
 
     /* Read the port number from the first command line argument. */
     int port = std::stoi(argv[1]);
 
     /* Read the root directory from the second command line argument. */
-    std::string root = (argv[2]);
+    std::string root = (argc == 3) ? argv[2] : "";
+
+    /*
+     * Opt-in request tracing: TORERO_TRACE=N traces one request in N. Dumps
+     * go to TORERO_TRACE_FILE (default torero-trace.json) on SIGUSR1, or can
+     * be fetched from /__trace. This must be set up before any threads start.
+     */
+    const char *trace_every = getenv("TORERO_TRACE");
+    if (trace_every != nullptr && std::atoi(trace_every) > 0) {
+        const char *trace_file = getenv("TORERO_TRACE_FILE");
+        RequestTracer::configure(std::atoi(trace_every));
+        RequestTracer::dumpOnSignal(SIGUSR1,
+                trace_file != nullptr ? trace_file : "torero-trace.json");
+    }
+
+    /*
+     * Opt-in per-client limits: TORERO_CLIENT_CONNECTIONS caps open
+     * connections per source address, TORERO_CLIENT_RATE (with burst
+     * TORERO_CLIENT_BURST) caps its requests per second, and
+     * TORERO_CLIENT_SEND_RATE paces each connection's file bodies to that
+     * many bytes per second. Clients over a limit get a 503 or 429.
+     */
+    double request_rate = envNumber("TORERO_CLIENT_RATE", 0);
+    client_limits = std::make_unique<ClientLimiter>(
+            envNumber("TORERO_CLIENT_CONNECTIONS", 0), request_rate,
+            envNumber("TORERO_CLIENT_BURST", request_rate));
+    client_send_rate = envNumber("TORERO_CLIENT_SEND_RATE", 0);
+
+#ifndef EMBEDDED_BUNDLE
+    /*
+     * Opt-in warm-up: with TORERO_WARMUP_FILE set, hits are counted and the
+     * hottest TORERO_WARMUP_TOP (default 256) paths are saved there every
+     * TORERO_WARMUP_INTERVAL seconds (default 60). On startup, before we
+     * listen, the saved paths are prefetched, spending at most
+     * TORERO_WARMUP_MS milliseconds (default 2000) and reading ahead at most
+     * TORERO_WARMUP_MB megabytes (default 256).
+     */
+    const char *warmup_file = getenv("TORERO_WARMUP_FILE");
+    if (warmup_file != nullptr) {
+        size_t top_n = envNumber("TORERO_WARMUP_TOP", 256);
+        WarmupBudget budget;
+        budget.time = std::chrono::milliseconds((long) envNumber("TORERO_WARMUP_MS", 2000));
+        budget.bytes = envNumber("TORERO_WARMUP_MB", 256) * 1024 * 1024;
+
+        if (hot_files.load(warmup_file) > 0) {
+            WarmupResult warmed = hot_files.prefetch(root, top_n, budget,
+                    [](const std::string &file_name) { mapped_files.acquire(file_name); });
+            cout << "Warmed " << warmed.files << " paths ("
+                 << warmed.bytes / (1024 * 1024) << " MB read ahead) in "
+                 << warmed.elapsed.count() << " ms"
+                 << (warmed.out_of_time ? ", out of time" : "") << "\n";
+            cout.flush();
+        }
+        record_hits = true;
+        hot_files.saveEvery(warmup_file, top_n,
+                std::chrono::seconds((long) envNumber("TORERO_WARMUP_INTERVAL", 60)));
+    }
+#endif
+
+    /*
+     * A client closing mid-response must only end its own connection.
+     * sendfile (unlike send) has no MSG_NOSIGNAL, so ignore SIGPIPE outright
+     * and let the write fail with EPIPE instead.
+     */
+    signal(SIGPIPE, SIG_IGN);
 
 	/* Create a socket and start listening for new connections on the
 	 * specified port. */
 	int server_sock = createSocketAndListen(port);
 
-	/* Now let's start accepting connections. */
-	acceptConnections(server_sock, root);
+	/* Now let's start accepting connections, using worker threads (the
+	 * default) or coroutines (TORERO_MODEL=coro). */
+	const char *model = getenv("TORERO_MODEL");
+	if (model != nullptr && std::string(model) == "coro") {
+		acceptConnectionsAsync(server_sock, root);
+	}
+	else {
+		acceptConnections(server_sock, root);
+	}
 
     close(server_sock);
 
@@ -119,11 +307,33 @@ void sendData(int socked_fd, const char *data, size_t data_length) {
             std::error_code ec(errno, std::generic_category());
             throw std::system_error(ec, "send failed");
         }
+        bytes_sent_by_thread += num_bytes_sent;
         data_length -= num_bytes_sent; //Readjust send size
         data += num_bytes_sent; //Calculate next buffer position
 	}
 }
 
+/**
+ * Sends a response body like sendData, but paced by the connection's
+ * SendShaper: the body goes out in chunks, sleeping before any chunk the
+ * shaper doesn't have tokens for yet.
+ *
+ * @param socket_fd The socket to send data over.
+ * @param data The data to send.
+ * @param data_length Number of bytes of data to send.
+ * @param shaper The connection's send-rate shaper.
+ */
+void sendShaped(int socked_fd, const char *data, size_t data_length,
+        SendShaper &shaper) {
+    while (data_length > 0) {
+        size_t chunk = shaper.chunkSize(data_length);
+        std::this_thread::sleep_for(shaper.reserve(chunk));
+        sendData(socked_fd, data, chunk);
+        data_length -= chunk;
+        data += chunk;
+    }
+}
+
 /**
  * Receives message over given socket, raising an exception if there was an
  * error in receiving.
@@ -150,34 +360,86 @@ int receiveData(int socked_fd, char *dest, size_t buff_size) {
  * may not be used again).
  *
  * @param client_sock The client's socket file descriptor.
+ * @param root The directory root name (ex. WWW/test/)
+ * @param client The client's IPv4 address.
  */
-void handleClient(const int client_sock, std::string root) {
+void handleClient(const int client_sock, std::string root, uint32_t client) {
 	// Step 1: Receive the request message from the client
 	char received_data[BUFFER_SIZE];
-	int bytes_received = receiveData(client_sock, received_data, BUFFER_SIZE);
+	int bytes_received;
+	{
+		TraceSpan span("recv");
+		bytes_received = receiveData(client_sock, received_data, BUFFER_SIZE);
+	}
 
 	// Turn the char array into a C++ string for easier processing.
 	string request_string(received_data, bytes_received);
     //std::cout << request_string << "\n";
 
+	if (wantsHttp2(request_string)) { //h2c, by prior knowledge or upgrade
+		Http2Slot slot;
+		if (slot.acquired) {
+			serveHttp2(client_sock, root, request_string, client);
+			close(client_sock);
+			return;
+		}
+		if (Http2Connection::startsWithPreface(request_string)) {
+			Http2Connection(client_sock, nullptr).refuse();
+			close(client_sock);
+			return;
+		}
+		// Too many h2 connections: answer the upgrade request as HTTP/1.0.
+	}
+
     // Parsing the request string to determine what response to generate.
 	// Using regex to determine if a request is properly formatted.
     
 	if (!validGET(request_string)) { //Testing for valid request
 		sendBad(client_sock);
+		close(client_sock);
 		return;
 	}
 	
-	std::istringstream f(request_string);
-	std::string file_name;
-	getline(f, file_name, ' ');
-	getline(f, file_name, ' '); //Tokenize file/dir name
+	std::string file_name, version;
+	parseRequestLine(request_string, file_name, version);
+	std::string query = splitQuery(file_name);
+
+	if (file_name == "/__trace" && RequestTracer::enabled()) { //Admin endpoint for trace dumps
+		sendTrace(client_sock);
+		close(client_sock);
+		return;
+	}
+
+#ifdef EMBEDDED_BUNDLE
+	// Everything is answered from the compiled-in bundle: no filesystem calls.
+	sendBundled(client_sock, request_string, file_name);
+	close(client_sock);
+	return;
+#endif
 
     root.append(file_name); //Using root parameter to find directory
 
-	if (!fileExists(root) && !isDirectory(root)) { //Testing for valid file/dir
+	bool is_directory, is_file;
+	{
+		TraceSpan span("lookup");
+		is_directory = isDirectory(root);
+		is_file = !is_directory && fileExists(root);
+	}
+
+	if (!is_file && !is_directory) { //Testing for valid file/dir
 		sendNotFound(client_sock); //Sending 404 if not found
         sendError(client_sock); //If non-existent file/dir, don't send header
+		close(client_sock);
+		return;
+	}
+	if (record_hits) {
+		hot_files.record(file_name);
+	}
+
+	ListingPage page;
+	if (is_directory && !parseListingPage(query, page)) {
+		sendBad(client_sock);
+		close(client_sock);
 		return;
 	}
 
@@ -187,20 +449,178 @@ void handleClient(const int client_sock, std::string root) {
     //Response is split into two sections: headers and relevant content
     //to avoid any data width conflicts. 
 
+	TraceSpan span("send");
 	sendOK(client_sock);
 
-    if (isDirectory(root))
+    if (is_directory)
     {
-        sendHTML(client_sock, root);
+        sendHTML(client_sock, root, page);
     }
 
-	else if (fileExists(root)) { //If not directory, send file immediately
-		sendHeader(client_sock, root);
-		sendFile(client_sock, root);
+	else if (is_file) { //If not directory, send file immediately
+		SendShaper shaper(client_send_rate);
+		sendFile(client_sock, root, shaper);
     }
 	close(client_sock);
 }
 
+/**
+ * Coroutine version of handleClient, for the TORERO_MODEL=coro model. It
+ * reads as the same straight-line steps, but each recv/send suspends this
+ * coroutine instead of blocking a thread, so an in-flight request costs one
+ * coroutine frame rather than a thread stack. Opening and stat-ing files
+ * (which can't be made non-blocking) run on the blocking pool; files are sent
+ * with sendfile. Directory listings and HTTP/2 connections reuse the blocking
+ * code, run off the event loop.
+ *
+ * @note The socket is closed, and the client's connection released, when this
+ * coroutine finishes.
+ *
+ * @param client_sock The client's socket file descriptor.
+ * @param root The directory root name (ex. WWW/test/)
+ * @param client The client's IPv4 address.
+ */
+Task<void> handleClientAsync(const int client_sock, std::string root, uint32_t client) {
+	struct ClientSlot {
+		uint32_t client;
+		~ClientSlot() { client_limits->release(client); }
+	} slot{ client };
+	AsyncSocket sock(client_sock);
+
+	// Step 1: Receive the request message from the client
+	char received_data[BUFFER_SIZE];
+	size_t bytes_received = co_await sock.recv(received_data, BUFFER_SIZE);
+	string request_string(received_data, bytes_received);
+
+	if (wantsHttp2(request_string)) { //long-lived, so it goes on the HTTP/2 pool
+		Http2Slot h2_slot;
+		if (h2_slot.acquired) {
+			sock.setBlocking();
+			co_await sock.blocking([&]() {
+				serveHttp2(client_sock, root, request_string, client);
+			}, true);
+			co_return;
+		}
+		if (Http2Connection::startsWithPreface(request_string)) {
+			Http2Connection(client_sock, nullptr).refuse();
+			co_return;
+		}
+		// Too many h2 connections: answer the upgrade request as HTTP/1.0.
+	}
+
+	if (!validGET(request_string)) { //Testing for valid request
+		co_await sock.send("HTTP/1.0 400 BAD REQUEST\r\n");
+		co_return;
+	}
+
+	std::string file_name, version;
+	parseRequestLine(request_string, file_name, version);
+	std::string query = splitQuery(file_name);
+
+	if (file_name == "/__trace" && RequestTracer::enabled()) { //Admin endpoint for trace dumps
+		co_await sock.send(traceResponse());
+		co_return;
+	}
+
+#ifdef EMBEDDED_BUNDLE
+	const char *header, *body;
+	size_t header_length, body_length;
+	if (!bundledResponse(request_string, file_name, header, header_length,
+				body, body_length)) {
+		co_await sock.send(notFoundResponse());
+		co_return;
+	}
+	co_await sock.send(header, header_length);
+	co_await sock.send(body, body_length);
+	co_return;
+#endif
+
+    root.append(file_name); //Using root parameter to find directory
+
+	// Look the path up and open it (or its index.html) off the event loop.
+	bool is_directory = false;
+	int file_fd = -1;
+	uint64_t file_size = 0;
+	co_await sock.blocking([&]() {
+		is_directory = isDirectory(root);
+		if (is_directory) {
+			fs::path index = fs::path(root) / "index.html";
+			if (!fs::is_regular_file(index)) {
+				return;
+			}
+			root = index.string();
+			is_directory = false;
+		}
+		file_fd = open(root.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (file_fd >= 0 && (fstat(file_fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+			close(file_fd);
+			file_fd = -1;
+		}
+		else if (file_fd >= 0) {
+			file_size = st.st_size;
+		}
+	});
+
+	if (file_fd < 0 && !is_directory) { //Testing for valid file/dir
+		co_await sock.send(notFoundResponse());
+		co_return;
+	}
+	if (record_hits) {
+		hot_files.record(file_name);
+	}
+
+	if (is_directory) {
+		ListingPage page;
+		if (!parseListingPage(query, page)) {
+			co_await sock.send("HTTP/1.0 400 BAD REQUEST\r\n");
+			co_return;
+		}
+		// The directory is read a piece at a time off the loop, and each
+		// piece is sent from the loop before the next is read.
+		ListingWriter listing(root, page, LISTING_FLUSH_SIZE);
+		co_await sock.send("HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n");
+		std::string chunk;
+		bool more = true;
+		while (true) {
+			co_await sock.blocking([&]() { more = listing.next(chunk); });
+			if (!more) {
+				break;
+			}
+			co_await sock.send(chunk.data(), chunk.length());
+		}
+		co_return;
+	}
+
+	std::string file_type;
+	if (!contentType(root, file_type)) {
+		file_type = "text/plain";
+	}
+	std::stringstream ss;
+	ss  << "HTTP/1.0 200 OK\r\n"
+		<< "Content-Type: " << file_type << "\r\n"
+		<< "Content-Length: " << file_size << "\r\n"
+		<< "\r\n";
+
+	try {
+		co_await sock.send(ss.str());
+		SendShaper shaper(client_send_rate); //paces the body, if a send rate is set
+		off_t offset = 0;
+		while ((uint64_t) offset < file_size) {
+			size_t chunk = shaper.chunkSize(file_size - offset);
+			co_await sleepFor(shaper.reserve(chunk));
+			co_await sock.sendfile(file_fd, offset, chunk);
+			offset += chunk;
+		}
+		co_await sock.send("\r\n", TRANSACTION_CLOSE); //close transaction
+	}
+	catch (...) {
+		close(file_fd);
+		throw;
+	}
+	close(file_fd);
+}
+
 /**
  * Creates a new socket and starts listening on that socket for new
  * connections.
@@ -320,6 +740,11 @@ void acceptConnections(const int server_sock, std::string root) {
             exit(1);
         }
 
+        uint32_t client = remote_addr.sin_addr.s_addr;
+        if (!admitClient(sock, client)) { //over a per-client limit
+            continue;
+        }
+
         /* 
 		 * At this point, you have a connected socket (named sock) that you can
          * use to send() and recv(). The handleClient function should handle all
@@ -329,25 +754,124 @@ void acceptConnections(const int server_sock, std::string root) {
 		 * into a shared buffer that is synchronized using condition variables.
          * 
          * Producer puts sock into BoundedBuffer, consumer threads take out.
+		 * Connections are taken out round-robin by client, not in arrival
+		 * order, so one client's backlog doesn't hold up everyone else's.
 		 */
 
-		buff.putItem(sock);
+		buff.putItem(sock, client);
     }
 }
 /**
  * Allows threads to wait on shared buffer to have a client socket available.
  * Calls handleClient when available. Producer puts sock into BoundedBuffer, 
- * consumer threads take out.
+ * consumer threads take out. Afterwards, the client is charged for the bytes
+ * sent (so heavy clients get their turn less often) and its connection is
+ * released.
  *
  * @param buffer A bounded buffer, shared amongst several threads.
  * @param root The directory root name (ex. WWW/test/)
  */
 void consume (BoundedBuffer &buffer, std::string root) {
     while (true) {
-        int shared_sock = buffer.getItem(); //thread gets socket from shared buffer
-        handleClient(shared_sock, root); //when available
+        RequestTracer::clock::time_point queued_at;
+        uint32_t client;
+        int shared_sock = buffer.getItem(queued_at, client); //thread gets socket from shared buffer
+        uint64_t bytes_before = bytes_sent_by_thread;
+
+        RequestTracer::beginRequest();
+        if (RequestTracer::sampled()) {
+            RequestTracer::record("queue", queued_at, RequestTracer::clock::now());
+        }
+        {
+            TraceSpan span("request");
+            try {
+                handleClient(shared_sock, root, client); //when available
+            }
+            catch (const std::system_error &e) {
+                close(shared_sock); //client went away mid-response
+            }
+        }
+        RequestTracer::endRequest();
+
+        buffer.charge(client, bytes_sent_by_thread - bytes_before);
+        client_limits->release(client);
+    }
+
+}
+
+/**
+ * Sit around forever accepting new connections from clients, starting a
+ * handleClientAsync coroutine for each one on a per-core scheduler.
+ *
+ * @param server_sock The socket used by the server.
+ * @param root The directory root name (ex. WWW/test/)
+ */
+void acceptConnectionsAsync(const int server_sock, std::string root) {
+    size_t num_loops = std::max(1u, std::thread::hardware_concurrency());
+    CoroScheduler scheduler(num_loops, NUM_BLOCKING_THREADS, NUM_HTTP2_THREADS);
+    Http2Slot::limit = NUM_HTTP2_THREADS; //so a slot always has a thread free
+
+    while (true) {
+        struct sockaddr_in remote_addr;
+        unsigned int socklen = sizeof(remote_addr);
+
+        int sock = accept(server_sock, (struct sockaddr*) &remote_addr, &socklen);
+        if (sock < 0) {
+            perror("Error accepting connection");
+            exit(1);
+        }
+
+        uint32_t client = remote_addr.sin_addr.s_addr;
+        if (!admitClient(sock, client)) { //over a per-client limit
+            continue;
+        }
+
+        scheduler.spawn(handleClientAsync(sock, root, client));
     }
+}
 
+/**
+ * Checks a newly accepted connection against the per-client limits. A client
+ * over its connection cap gets a 503, and one over its request rate a 429;
+ * either way the connection is closed without being queued. The response is
+ * sent without waiting, since this runs on the accepting thread.
+ *
+ * @param client_sock The new connection's socket file descriptor.
+ * @param client The client's IPv4 address.
+ * @returns true if the connection was admitted (and must later be released).
+ */
+bool admitClient(const int client_sock, uint32_t client) {
+    ClientLimiter::Admission admission = client_limits->admit(client);
+    if (admission == ClientLimiter::ADMITTED) {
+        return true;
+    }
+    std::string rs = (admission == ClientLimiter::TOO_MANY_CONNECTIONS)
+        ? "HTTP/1.0 503 SERVICE UNAVAILABLE\r\n"
+        : "HTTP/1.0 429 TOO MANY REQUESTS\r\n";
+    rs += "Retry-After: 1\r\n\r\n";
+    send(client_sock, rs.c_str(), rs.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_sock);
+    return false;
+}
+
+/**
+ * Reads a non-negative number from an environment variable.
+ *
+ * @param name The variable's name.
+ * @param default_value Used if the variable is unset or not a number.
+ * @returns The variable's value.
+ */
+double envNumber(const char *name, double default_value) {
+    const char *value = getenv(name);
+    if (value == nullptr) {
+        return default_value;
+    }
+    char *end;
+    double number = std::strtod(value, &end);
+    if (end == value || number < 0) {
+        return default_value;
+    }
+    return number;
 }
 
 /**
@@ -358,8 +882,8 @@ void consume (BoundedBuffer &buffer, std::string root) {
  */
 
 bool validGET(std::string request) {
-    //checks for GET \s (whitespace) \w ./(filename and extension) HTTP \d.\d (any HTTP version)
-    std::regex http_request_regex("(GET\\s[\\w\\-\\./]*\\sHTTP/\\d\\.\\d)");
+    //checks for GET \s (whitespace) \w ./(filename and extension) ?query HTTP \d.\d (any HTTP version)
+    std::regex http_request_regex("(GET\\s[\\w\\-\\./]*(\\?[\\w=&%\\-\\.~]*)?\\sHTTP/\\d\\.\\d)");
 	std::smatch request_match;
 
 	if (std::regex_search(request, request_match, http_request_regex)) {
@@ -369,6 +893,102 @@ bool validGET(std::string request) {
         return false;
     }
 }
+/**
+ * Pulls the requested path and HTTP version out of a request line that
+ * validGET has accepted.
+ *
+ * @param request Given request message from client.
+ * @param file_name Set to the requested path (including any ?query).
+ * @param version Set to the HTTP version (e.g. "HTTP/1.1").
+ */
+void parseRequestLine(const std::string &request, std::string &file_name,
+        std::string &version) {
+	std::istringstream f(request);
+	getline(f, file_name, ' ');
+	getline(f, file_name, ' '); //Tokenize file/dir name
+	getline(f, version, '\r');
+}
+
+/**
+ * Splits off any ?query string from a requested path.
+ *
+ * @param file_name The requested path; the query is removed from it.
+ * @returns The query string, without the leading '?'.
+ */
+std::string splitQuery(std::string &file_name) {
+	std::string query;
+	size_t query_start = file_name.find('?');
+	if (query_start != std::string::npos) {
+		query = file_name.substr(query_start + 1);
+		file_name.erase(query_start);
+	}
+	return query;
+}
+
+/**
+ * Reads after= (a percent-encoded name), offset=, and limit= out of a
+ * directory listing's query string. Any other parameters are ignored.
+ *
+ * @param query The query string, without the leading '?'.
+ * @param page Filled in with the requested page.
+ * @returns false if the page is malformed or too large to sort in bounded
+ * memory.
+ */
+bool parseListingPage(const std::string &query, ListingPage &page) {
+    std::istringstream params(query);
+    std::string param;
+    while (getline(params, param, '&')) {
+        size_t eq = param.find('=');
+        if (eq == std::string::npos) {
+            continue;
+        }
+        std::string name = param.substr(0, eq);
+        std::string value = param.substr(eq + 1);
+        if (name == "after") {
+            if (!percentDecode(value, page.after)) {
+                return false;
+            }
+        }
+        else if (name == "offset" || name == "limit") {
+            if (value.empty() || value.length() > 9
+                    || value.find_first_not_of("0123456789") != std::string::npos) {
+                return false;
+            }
+            (name == "offset" ? page.offset : page.limit) = std::stoul(value);
+        }
+        else {
+            continue;
+        }
+        page.paginated = true;
+    }
+    return page.limit > 0 && page.offset + page.limit <= MAX_LISTING_WINDOW;
+}
+
+/**
+ * Reverses the percent-encoding of a query value (e.g. the after= in a
+ * listing's next-page link).
+ *
+ * @param value The encoded string.
+ * @param decoded Set to the decoded string.
+ * @returns false if a '%' isn't followed by two hex digits.
+ */
+bool percentDecode(const std::string &value, std::string &decoded) {
+    decoded.clear();
+    for (size_t i = 0; i < value.length(); ++i) {
+        if (value[i] != '%') {
+            decoded += value[i];
+            continue;
+        }
+        if (i + 2 >= value.length() || !isxdigit((unsigned char) value[i + 1])
+                || !isxdigit((unsigned char) value[i + 2])) {
+            return false;
+        }
+        decoded += (char) std::stoi(value.substr(i + 1, 2), nullptr, 16);
+        i += 2;
+    }
+    return true;
+}
+
 /**
  * Checks if the requested file exists and is in the root directory.
  *
@@ -429,6 +1049,52 @@ void sendOK(const int client_sock) {
     sendData(client_sock, rs.c_str(), rs.length());
 }
 
+/**
+ * Picks the Content-Type for a file from its extension.
+ *
+ * @param file_name The requested file.
+ * @param file_type Set to the MIME type (text/plain if unrecognized).
+ * @returns false if the file name has no extension at all.
+ */
+bool contentType(const std::string &file_name, std::string &file_type) {
+    std::regex rgx("(\\.\\w*)"); //regex expression matches '\. \w*', checking for file extension
+    std::smatch request_match;
+
+    if (!std::regex_search(file_name, request_match, rgx)) {
+        return false;
+    }
+
+    //Most common file types, more types can be added here if needed
+    if (request_match[0] == ".html")
+    {
+        file_type = "text/html";
+    }
+    else if (request_match[0] == ".css")
+    {
+        file_type = "text/css";
+    }
+    else if (request_match[0] == ".jpg")
+    {
+        file_type = "image/jpeg";
+    }
+    else if (request_match[0] == ".gif")
+    {
+        file_type = "image/gif";
+    }
+    else if (request_match[0] == ".png")
+    {
+        file_type = "image/png";
+    }
+    else if (request_match[0] == ".pdf") //Firefox error?
+    {
+        file_type = "application/pdf";
+    }
+    else {
+        file_type = "text/plain"; 
+    }
+    return true;
+}
+
 /**
  * Sends the relevant HTTP headers, excluding file data.
  * Uses stringstream to facilitate future expansion (only
@@ -436,53 +1102,19 @@ void sendOK(const int client_sock) {
  *
  * @param client_sock The client's socket file descriptor.
  * @param file_name The requested file to send. 
+ * @param content_length Size of the body that will follow.
  */
 
-void sendHeader(const int client_sock, std::string file_name) {
-    std::regex rgx("(\\.\\w*)"); //regex expression matches '\. \w*', checking for file extension
-    std::smatch request_match;
+void sendHeader(const int client_sock, std::string file_name, uint64_t content_length) {
     std::string file_type;
-    std::string size;
-
-    if (std::regex_search(file_name, request_match, rgx))
-    {
-        //Most common file types, more types can be added here if needed
-        if (request_match[0] == ".html")
-        {
-            file_type = "text/html";
-        }
-        else if (request_match[0] == ".css")
-        {
-            file_type = "text/css";
-        }
-        else if (request_match[0] == ".jpg")
-        {
-            file_type = "image/jpeg";
-        }
-        else if (request_match[0] == ".gif")
-        {
-            file_type = "image/gif";
-        }
-        else if (request_match[0] == ".png")
-        {
-            file_type = "image/png";
-        }
-        else if (request_match[0] == ".pdf") //Firefox error?
-        {
-            file_type = "application/pdf";
-        }
-        else {
-            file_type = "text/plain"; 
-        }
-    }
-    else {
+    if (!contentType(file_name, file_type)) {
         std::cout << "No match!\n";
         return;
     }
 
     std::stringstream ss;
     ss  << "Content-Type: " << file_type << "\r\n"
-        << "Content-Length: " << std::to_string(fs::file_size(file_name)) << "\r\n"
+        << "Content-Length: " << std::to_string(content_length) << "\r\n"
         << "\r\n";
 
     std::string response = ss.str();
@@ -494,11 +1126,16 @@ void sendHeader(const int client_sock, std::string file_name) {
  * inside a specified directory. Checks if the specified dir has 
  * index.html; if so, it displays index.html instead.
  *
+ * The listing is streamed out as the directory is read rather than built up
+ * in memory first, so there is no Content-Length: the body ends when the
+ * connection is closed (as HTTP/1.0 allows).
+ *
  * @param client_sock The client's socket file descriptor.
  * @param file_name The requested file to send. 
+ * @param page Which part of the listing to send.
  */
   
-void sendHTML(const int client_sock, std::string file_name) {
+void sendHTML(const int client_sock, std::string file_name, const ListingPage &page) {
 	 // handle client should check if URL ends in a /
 
      std::stringstream ss;
@@ -522,62 +1159,85 @@ void sendHTML(const int client_sock, std::string file_name) {
             return;
      }
 
-    //Start auto-generating HTML directory list page
-     ss  << "<html>" << "\r\n"
-         << "<head>" << "<title></title>" << "</head>" << "\r\n" //Can modify for better UX
-         << "<body>" << "\r\n"
-         << "<ul>" << "\r\n"; //Making auto-generated bulleted list
+     fs::path index = fs::path(file_name) / "index.html";
+     if (fs::is_regular_file(index)) { //If there is an index.html, return it instead of a listing
+         SendShaper shaper(client_send_rate);
+         sendFile(client_sock, index.string(), shaper);
+         return;
+     }
 
-     for (auto& entry: fs::directory_iterator(file_name)) {
-        //std::string file = entry.path().filename(); 
+    std::string header = "Content-Type: text/html\r\n\r\n"; //header info, length unknown up front
+    sendData(client_sock, header.c_str(), header.length());
+    writeListing(file_name, page, [client_sock](const std::string &chunk) {
+        sendData(client_sock, chunk.c_str(), chunk.length());
+    });
+}
 
-     	if (entry.path().filename() == "index.html") { //If we find index.html, stop auto-generating HTML and return the index immediately
-            sendHeader(client_sock, entry.path());
-            sendFile(client_sock, entry.path());
-            return;
-        }
-        else if (fs::is_regular_file(file_name + entry.path().filename().string())) { //Check for filenames and add in all files
-	    	ss << "\t<li><a href=\"" << entry.path().filename().string() << "\">" << entry.path().filename().string() << "</a></li>\r\n";
-        }
-		else if (fs::is_directory(file_name + entry.path().filename().string())) {
-			ss << "\t<li><a href=\"" << entry.path().filename().string() << "/\">" << entry.path().filename().string() << "/</a></li>\r\n"; //generate HTML href
-        }
-        else {
-            //cout << "Blank file directory\r\n"; //Given directory is empty
-        }
-   	 }
-    	ss << "</ul>" << "\r\n"
-	   	   << "</body>" << "\r\n"
-    	   << "</html>" << "\r\n";
-	 
-	 std::string html_pg = ss.str();
-	 std::stringstream response2;
-
-	 response2  << "Content-Type: " << "text/html" << "\r\n" //appending header info
-	 			<< "Content-Length: " << html_pg.length() << "\r\n"
-				<< "\r\n" << html_pg << "\r\n";
-	 std::string send_pg2 = response2.str();
-	 sendData(client_sock, send_pg2.c_str(), send_pg2.length());
-}
-/**
- * Sends the requested file, separate from the headers.
+/**
+ * Generates the HTML listing of a directory's files and subdirectories (see
+ * ListingWriter), handing it to emit in pieces of roughly LISTING_FLUSH_SIZE
+ * bytes as the directory is read.
+ *
+ * @param dir_name The directory to list.
+ * @param page Which part of the listing to generate.
+ * @param emit Called with each piece of the page, in order.
+ */
+void writeListing(const std::string &dir_name, const ListingPage &page,
+        const std::function<void(const std::string &)> &emit) {
+    ListingWriter listing(dir_name, page, LISTING_FLUSH_SIZE);
+    std::string chunk;
+    while (listing.next(chunk)) {
+        emit(chunk);
+    }
+}
+/**
+ * Sends the requested file's headers, then the file. The Content-Length is
+ * taken from what will actually be sent (the mapping, if the file is
+ * cached), so a file changing between the two can't make them disagree.
  * 
  * @param client_sock The client's socket file descriptor.
  * @param file_name The requested file to send. 
+ * @param shaper Paces the body to the connection's send rate, if it has one.
  */
 
-void sendFile(const int client_sock, std::string file_name) {
+void sendFile(const int client_sock, std::string file_name, SendShaper &shaper) {
+    std::shared_ptr<const MappedFile> mapping = mapped_files.acquire(file_name);
+    if (mapping) {
+        sendHeader(client_sock, file_name, mapping->length);
+        /*
+         * Send straight from the mapping. If the file is truncated while we
+         * are sending, the kernel's copy out of the missing pages fails with
+         * EFAULT (rather than raising SIGBUS in this thread), so drop the
+         * stale mapping and cut the response short.
+         */
+        try {
+            sendShaped(client_sock, mapping->data, mapping->length, shaper);
+        }
+        catch (const std::system_error &e) {
+            if (e.code().value() != EFAULT) {
+                throw;
+            }
+            mapped_files.invalidate(file_name);
+            return;
+        }
+        sendData(client_sock, "\r\n", TRANSACTION_CLOSE); //close transaction
+        return;
+    }
+
     //open file, place data into buffer, and send
     std::ifstream file(file_name, std::ios::binary);
+    uint64_t remaining = fs::file_size(file_name);
+    sendHeader(client_sock, file_name, remaining);
 
     const unsigned int buffer_size = 4096;
     char file_data[buffer_size];
 
-    //keep reading until EOF
-    while (!file.eof()) {
-        file.read(file_data, buffer_size); //Read up to buffer_size bytes into data buffer
+    //keep reading until EOF, or until the advertised length has been sent
+    while (!file.eof() && remaining > 0) {
+        file.read(file_data, std::min<uint64_t>(buffer_size, remaining)); //Read up to buffer_size bytes into data buffer
         int bytes_read = file.gcount();
-        sendData(client_sock, file_data, bytes_read);
+        sendShaped(client_sock, file_data, bytes_read, shaper);
+        remaining -= bytes_read;
     }
     file.close();
     sendData(client_sock, "\r\n", TRANSACTION_CLOSE); //close transaction
@@ -586,15 +1246,7 @@ void sendFile(const int client_sock, std::string file_name) {
 void sendError(const int client_sock) {
 
     cout << "Error!";
-    std::stringstream ss;
-    ss  << "<html>" << "\r\n"
-    << "<head>" << "\r\n"
-    << "<title> Page not found! </title>" << "\r\n"
-    << "</head>" << "\r\n"
-    << "<body> 404 Page Not Found! </body>" << "\r\n"
-    << "</html>" << "\r\n";
-    
-    std::string error_pg = ss.str();
+    std::string error_pg = errorPage();
     std::stringstream response;
     response << "Content-Type: " << "text/html" << "\r\n"
                 << "Content-Length: " << error_pg.length() << "\r\n"
@@ -604,3 +1256,312 @@ void sendError(const int client_sock) {
     sendData(client_sock, send_pg1.c_str(), send_pg1.length());
     return;
 }
+
+/**
+ * Finds the value of a request header (case-insensitive name match).
+ *
+ * @param request The full request message from the client.
+ * @param name The header name, without the trailing ':'.
+ * @returns The header's value with surrounding whitespace trimmed, or an
+ * empty string if the header isn't present.
+ */
+std::string headerValue(const std::string &request, const std::string &name) {
+    size_t line_start = request.find("\r\n");
+    while (line_start != std::string::npos) {
+        line_start += 2;
+        size_t line_end = request.find("\r\n", line_start);
+        if (line_end == std::string::npos) {
+            line_end = request.length();
+        }
+        if (line_end - line_start > name.length()
+                && request[line_start + name.length()] == ':'
+                && strncasecmp(request.c_str() + line_start, name.c_str(),
+                    name.length()) == 0) {
+            size_t value_start = request.find_first_not_of(" \t",
+                    line_start + name.length() + 1);
+            size_t value_end = request.find_last_not_of(" \t", line_end - 1);
+            if (value_start == std::string::npos || value_start > value_end) {
+                return "";
+            }
+            return request.substr(value_start, value_end - value_start + 1);
+        }
+        if (line_end == request.length()) {
+            break;
+        }
+        line_start = line_end;
+    }
+    return "";
+}
+
+#ifdef EMBEDDED_BUNDLE
+/**
+ * Answers a request from the compiled-in asset bundle. Headers are prebuilt
+ * by bundle-gen, so this just sends the variant bundledResponse picks.
+ *
+ * @param client_sock The client's socket file descriptor.
+ * @param request The full request message from the client.
+ * @param file_name The requested path (e.g. "/index.html").
+ */
+void sendBundled(const int client_sock, const std::string &request,
+		const std::string &file_name) {
+    const char *header, *body;
+    size_t header_length, body_length;
+    if (!bundledResponse(request, file_name, header, header_length, body, body_length)) {
+        sendNotFound(client_sock);
+        sendError(client_sock);
+        return;
+    }
+    sendData(client_sock, header, header_length);
+    sendData(client_sock, body, body_length);
+}
+
+/**
+ * Picks which prebuilt response (304, gzip, or identity) answers a request
+ * from the bundle.
+ *
+ * @param request The full request message from the client.
+ * @param file_name The requested path (e.g. "/index.html").
+ * @param header Set to the prebuilt status line and headers.
+ * @param header_length Set to the length of header.
+ * @param body Set to the body to send after the header.
+ * @param body_length Set to the length of body (0 for a 304).
+ * @returns false if the path isn't in the bundle.
+ */
+bool bundledResponse(const std::string &request, const std::string &file_name,
+		const char *&header, size_t &header_length,
+		const char *&body, size_t &body_length) {
+    const Asset *asset = findAsset(file_name);
+    if (asset == nullptr) {
+        return false;
+    }
+
+    if (headerValue(request, "If-None-Match") == asset->etag) {
+        header = asset->not_modified;
+        header_length = asset->not_modified_length;
+        body = nullptr;
+        body_length = 0;
+    }
+    else if (asset->gzip_body != nullptr
+            && headerValue(request, "Accept-Encoding").find("gzip") != std::string::npos) {
+        header = asset->gzip_header;
+        header_length = asset->gzip_header_length;
+        body = (const char *) asset->gzip_body;
+        body_length = asset->gzip_body_length;
+    }
+    else {
+        header = asset->header;
+        header_length = asset->header_length;
+        body = (const char *) asset->body;
+        body_length = asset->body_length;
+    }
+    return true;
+}
+#endif
+
+/**
+ * Sends the current trace buffers as Chrome trace_event JSON.
+ *
+ * @param client_sock The client's socket file descriptor.
+ */
+void sendTrace(const int client_sock) {
+    std::string response = traceResponse();
+    sendData(client_sock, response.c_str(), response.length());
+}
+
+/**
+ * Builds the full /__trace response (status line, headers, and JSON).
+ *
+ * @returns The response.
+ */
+std::string traceResponse() {
+    std::string trace = RequestTracer::dumpJSON();
+    std::stringstream ss;
+    ss  << "HTTP/1.0 200 OK\r\n"
+        << "Content-Type: application/json\r\n"
+        << "Content-Length: " << trace.length() << "\r\n"
+        << "\r\n" << trace;
+    return ss.str();
+}
+
+/**
+ * The body of the generic 404 page.
+ *
+ * @returns The page's HTML.
+ */
+std::string errorPage() {
+    std::stringstream ss;
+    ss  << "<html>" << "\r\n"
+    << "<head>" << "\r\n"
+    << "<title> Page not found! </title>" << "\r\n"
+    << "</head>" << "\r\n"
+    << "<body> 404 Page Not Found! </body>" << "\r\n"
+    << "</html>" << "\r\n";
+    return ss.str();
+}
+
+/**
+ * Works out the response to one HTTP/2 request. This makes the same choices
+ * as handleClient (400 for anything but GET/HEAD, 404, index.html, directory
+ * listing, or the file itself), but returns the response instead of writing
+ * it, so the connection can interleave it with other streams.
+ *
+ * @param root The directory root name (ex. WWW/test/)
+ * @param method The request's :method.
+ * @param path The request's :path (may include a ?query).
+ * @returns The response to send.
+ */
+Http2Response resolveHttp2(std::string root, const std::string &method,
+        const std::string &path) {
+    Http2Response response;
+    std::string file_name = path;
+    std::string query = splitQuery(file_name);
+
+    if ((method != "GET" && method != "HEAD") || file_name.empty()
+            || file_name[0] != '/' || file_name.find("..") != std::string::npos) {
+        response.status = 400;
+        return response;
+    }
+
+#ifdef EMBEDDED_BUNDLE
+    const Asset *asset = findAsset(file_name);
+    if (asset == nullptr) {
+        response.status = 404;
+        response.content_type = "text/html";
+        response.body = errorPage();
+    }
+    else {
+        response.content_type = asset->mime_type;
+        response.body.assign((const char *) asset->body, asset->body_length);
+    }
+    response.content_length = response.body.length();
+    return response;
+#endif
+
+    root.append(file_name);
+    ListingPage page;
+    if (isDirectory(root)) {
+        fs::path index = fs::path(root) / "index.html";
+        if (fs::is_regular_file(index)) {
+            root = index.string();
+        }
+        else if (!parseListingPage(query, page)) {
+            response.status = 400;
+            return response;
+        }
+        else {
+            // Streamed a piece at a time as the client's window allows.
+            auto listing = std::make_shared<ListingWriter>(root, page, LISTING_FLUSH_SIZE);
+            response.content_type = "text/html";
+            response.body_source = [listing](std::string &chunk) {
+                return listing->next(chunk);
+            };
+            return response;
+        }
+    }
+
+    std::error_code ec;
+    uint64_t size = fs::file_size(root, ec);
+    if (ec || !fs::is_regular_file(root)) {
+        response.status = 404;
+        response.content_type = "text/html";
+        response.body = errorPage();
+        response.content_length = response.body.length();
+        return response;
+    }
+
+    if (record_hits) {
+        hot_files.record(file_name);
+    }
+    if (!contentType(root, response.content_type)) {
+        response.content_type = "text/plain";
+    }
+    response.file_name = root;
+    response.content_length = size;
+    return response;
+}
+
+/**
+ * Checks whether a connection wants HTTP/2: either it opened with the h2
+ * preface (prior knowledge), or it is a valid GET asking to upgrade to h2c.
+ * This runs on every request, so the header checks come first and the
+ * request line is only validated for actual upgrade requests.
+ *
+ * @param request The first data received on the connection.
+ * @returns true if the connection should be handed to serveHttp2.
+ */
+bool wantsHttp2(const std::string &request) {
+    if (Http2Connection::startsWithPreface(request)) {
+        return true;
+    }
+    if (headerValue(request, "Upgrade").find("h2c") == std::string::npos
+            || headerValue(request, "HTTP2-Settings").empty()
+            || !validGET(request)) {
+        return false;
+    }
+    std::string file_name, version;
+    parseRequestLine(request, file_name, version);
+    return version == "HTTP/1.1";
+}
+
+/**
+ * Serves an HTTP/2 connection (see wantsHttp2) until it closes. For an
+ * upgrade, the 101 response is sent first and the upgrading request is
+ * answered as stream 1. Nagle's algorithm is turned off first: each round
+ * of frames goes out in one write anyway, and otherwise the frame that fills
+ * a client's flow-control window sits waiting on the client's delayed ACK.
+ *
+ * @param client_sock The client's socket file descriptor (not closed here).
+ * @param root The directory root name (ex. WWW/test/)
+ * @param request The first data received on the connection.
+ * @param client The client's IPv4 address. Every stream after the first
+ * (which was counted when the connection was admitted) takes a request token.
+ */
+void serveHttp2(const int client_sock, std::string root, const std::string &request,
+        uint32_t client) {
+    int nodelay = 1;
+    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    bool first_stream = true;
+    SendShaper shaper(client_send_rate);
+    Http2Connection h2(client_sock, [root, client, &first_stream](
+                const std::string &method, const std::string &path) {
+        if (!first_stream && !client_limits->allowRequest(client)) {
+            Http2Response response;
+            response.status = 429;
+            return response;
+        }
+        first_stream = false;
+        return resolveHttp2(root, method, path);
+    }, [client_sock](const char *data, size_t length) {
+        sendData(client_sock, data, length); //counted, so the client is charged
+    }, &shaper);
+
+    if (Http2Connection::startsWithPreface(request)) {
+        h2.serve(request);
+        return;
+    }
+
+    std::string file_name, version;
+    parseRequestLine(request, file_name, version);
+    std::string rs = "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: h2c\r\n\r\n";
+    sendData(client_sock, rs.c_str(), rs.length());
+    h2.serveUpgrade("GET", file_name, headerValue(request, "HTTP2-Settings"));
+}
+
+/**
+ * Builds a full 404 response (the same bytes sendNotFound and sendError
+ * send), for senders that want it in one piece.
+ *
+ * @returns The response.
+ */
+std::string notFoundResponse() {
+    std::string error_pg = errorPage();
+    std::stringstream response;
+    response << "HTTP/1.0 404 NOT FOUND\r\n"
+             << "Content-Type: " << "text/html" << "\r\n"
+             << "Content-Length: " << error_pg.length() << "\r\n"
+             << "\r\n" << error_pg << "\r\n";
+    return response.str();
+}